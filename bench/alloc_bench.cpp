@@ -0,0 +1,143 @@
+// Counts the heap allocations made by the server for each request.
+//
+// Replaces the global operator new with a counting one, serves a static page
+// and a page with a path parameter on loopback, and sends keep-alive GETs
+// with browser-like headers from a client that does not allocate. The count
+// only covers C++ allocations: libmicrohttpd's own mallocs are not seen.
+//
+//   alloc-bench [requests] [port]
+
+#include <httpi/displayer.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static std::atomic<long> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// Sends one request and reads the whole response. Returns false on error.
+static bool Get(int fd, const char* url) {
+    char req[1024];
+    int len = std::snprintf(
+        req,
+        sizeof(req),
+        "GET %s HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+        "Gecko/20100101 Firefox/115.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+        "*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n",
+        url);
+    if (write(fd, req, len) != len) {
+        return false;
+    }
+
+    static char buf[1 << 16];
+    size_t got = 0;
+    const char* body = nullptr;
+    size_t content_length = 0;
+    while (!body || got < static_cast<size_t>(body - buf) + content_length) {
+        ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+        if (!body) {
+            const char* end = static_cast<const char*>(
+                memmem(buf, got, "\r\n\r\n", 4));
+            if (end) {
+                body = end + 4;
+                const char* cl = static_cast<const char*>(
+                    memmem(buf, end - buf, "Content-Length: ", 16));
+                content_length = cl ? std::atol(cl + 16) : 0;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    long requests = argc > 1 ? std::atol(argv[1]) : 100000;
+    int port = argc > 2 ? std::atoi(argv[2]) : 8089;
+
+    HTTPServer server(port);
+    if (!server.IsRunning()) {
+        std::fprintf(stderr, "cannot listen on port %d\n", port);
+        return 1;
+    }
+
+    auto page = std::make_shared<const std::string>(
+        "<html><body>" + std::string(512, 'x') + "</body></html>");
+    server.RegisterUrl("/static", [page](const std::string&, const POSTValues&) {
+        return httpi::Response(page);
+    });
+    server.RegisterUrl(
+        "/jobs/:id",
+        [page](const std::string&,
+               const POSTValues& args,
+               const httpi::PathParams& params) {
+            // Touch the request like a real handler would.
+            bool json = args.find("Accept") != args.end() &&
+                        params.Get("id").size() > 0;
+            return httpi::Response(page).Status(json ? 200 : 500);
+        });
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::perror("connect");
+        return 1;
+    }
+
+    const char* urls[] = {"/static", "/jobs/42"};
+    for (const char* url : urls) {
+        // Let the connection pool and arenas reach their steady state.
+        for (int i = 0; i < 1000; ++i) {
+            if (!Get(fd, url)) {
+                std::fprintf(stderr, "request failed\n");
+                return 1;
+            }
+        }
+
+        long before = allocations.load();
+        for (long i = 0; i < requests; ++i) {
+            Get(fd, url);
+        }
+        long total = allocations.load() - before;
+        std::printf("%-10s %ld requests, %ld allocations, %.3f per request\n",
+                    url,
+                    requests,
+                    total,
+                    static_cast<double>(total) / requests);
+    }
+
+    close(fd);
+    return 0;
+}
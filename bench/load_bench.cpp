@@ -0,0 +1,257 @@
+// Load tests the example app over loopback: starts an HTTPServer with the
+// example routes, drives it from N client threads each holding a keep-alive
+// connection, and reports the throughput and latency percentiles of each
+// route.
+//
+//   bench [client threads] [seconds] [port] [server threads]
+
+#include <httpi/displayer.h>
+#include <httpi/webjob.h>
+#include <routes.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The request mix, in proportion of their weights. Each /permute starts a
+// job: it is sent less often.
+struct Target {
+    const char* route;
+    const char* url;
+    int weight;
+};
+
+const Target kTargets[] = {
+    {"/", "/", 4},
+    {"/compute", "/compute?a=12&b=30", 4},
+    {"/jobs", "/jobs", 2},
+    {"/permute", "/permute?str=abcd", 1},
+};
+const size_t kNbTargets = sizeof(kTargets) / sizeof(kTargets[0]);
+
+class Connection {
+   public:
+    explicit Connection(int port) : fd_(socket(AF_INET, SOCK_STREAM, 0)) {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ok_ = connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ==
+              0;
+    }
+    ~Connection() { close(fd_); }
+
+    bool ok() const { return ok_; }
+
+    // Sends a GET and reads the whole response. Returns its status, or 0 if
+    // the connection failed.
+    int Get(const char* url) {
+        char req[512];
+        int len = std::snprintf(req,
+                                sizeof(req),
+                                "GET %s HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "Accept: text/html\r\n"
+                                "Accept-Encoding: gzip\r\n"
+                                "Connection: keep-alive\r\n"
+                                "\r\n",
+                                url);
+        if (write(fd_, req, len) != len) {
+            return 0;
+        }
+
+        size_t end = 0;
+        while ((end = buf_.find("\r\n\r\n")) == std::string::npos) {
+            if (!Fill()) {
+                return 0;
+            }
+        }
+        std::string head = buf_.substr(0, end + 2);
+        buf_.erase(0, end + 4);
+
+        int status = std::atoi(head.c_str() + head.find(' ') + 1);
+        if (head.find("Transfer-Encoding: chunked") != std::string::npos) {
+            return SkipChunked() ? status : 0;
+        }
+        size_t cl = head.find("Content-Length: ");
+        size_t length =
+            cl == std::string::npos ? 0 : std::atol(head.c_str() + cl + 16);
+        return Skip(length) ? status : 0;
+    }
+
+   private:
+    bool Fill() {
+        char tmp[1 << 16];
+        ssize_t n = read(fd_, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf_.append(tmp, n);
+        return true;
+    }
+
+    bool Skip(size_t n) {
+        while (buf_.size() < n) {
+            if (!Fill()) {
+                return false;
+            }
+        }
+        buf_.erase(0, n);
+        return true;
+    }
+
+    bool SkipChunked() {
+        while (true) {
+            size_t eol;
+            while ((eol = buf_.find("\r\n")) == std::string::npos) {
+                if (!Fill()) {
+                    return false;
+                }
+            }
+            size_t size = std::strtoul(buf_.c_str(), nullptr, 16);
+            buf_.erase(0, eol + 2);
+            if (!Skip(size + 2)) {
+                return false;
+            }
+            if (size == 0) {
+                return true;
+            }
+        }
+    }
+
+    int fd_;
+    bool ok_;
+    std::string buf_;
+};
+
+// Latencies in microseconds of one client thread, by target.
+struct Samples {
+    std::vector<uint32_t> latency[kNbTargets];
+    size_t errors = 0;
+};
+
+uint32_t Percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    return sorted[i];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned nb_clients = argc > 1 ? std::atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 5;
+    int port = argc > 3 ? std::atoi(argv[3]) : 8090;
+    unsigned nb_threads =
+        argc > 4 ? std::atoi(argv[4])
+                 : std::max(2u, std::thread::hardware_concurrency());
+
+    // Every /permute starts a job: keep the jobs page from growing for the
+    // whole run. Declared before the server, whose handlers use it.
+    WebJobsPool jp(WebJobsPool::DefaultConcurrency(),
+                   WebJobRetention(1000, std::chrono::seconds(0), 0));
+    HTTPServer server(port, ServerConfig::ThreadPool(nb_threads));
+    if (!server.IsRunning()) {
+        std::fprintf(stderr, "cannot listen on port %d\n", port);
+        return 1;
+    }
+    RegisterExampleRoutes(server, jp);
+
+    std::vector<size_t> schedule;
+    for (size_t i = 0; i < kNbTargets; ++i) {
+        schedule.insert(schedule.end(), kTargets[i].weight, i);
+    }
+
+    std::atomic<bool> stop(false);
+    std::vector<Samples> samples(nb_clients);
+    std::vector<std::thread> clients;
+    for (unsigned c = 0; c < nb_clients; ++c) {
+        clients.emplace_back([&, c]() {
+            Connection conn(port);
+            Samples& mine = samples[c];
+            for (size_t i = c; !stop && conn.ok(); ++i) {
+                size_t t = schedule[i % schedule.size()];
+                auto begin = std::chrono::steady_clock::now();
+                int status = conn.Get(kTargets[t].url);
+                auto end = std::chrono::steady_clock::now();
+                if (status != 200) {
+                    ++mine.errors;
+                    if (status == 0) {
+                        break;
+                    }
+                    continue;
+                }
+                mine.latency[t].push_back(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        end - begin)
+                        .count());
+            }
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& c : clients) {
+        c.join();
+    }
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+
+    std::printf("%u clients, %u server threads, %.1f s\n",
+                nb_clients,
+                nb_threads,
+                elapsed);
+    std::printf("%-10s %10s %10s %10s %10s %10s\n",
+                "route",
+                "requests",
+                "req/s",
+                "p50 us",
+                "p99 us",
+                "p999 us");
+    size_t total = 0;
+    size_t errors = 0;
+    for (size_t t = 0; t < kNbTargets; ++t) {
+        std::vector<uint32_t> all;
+        for (auto& s : samples) {
+            all.insert(all.end(), s.latency[t].begin(), s.latency[t].end());
+        }
+        std::sort(all.begin(), all.end());
+        total += all.size();
+        std::printf("%-10s %10zu %10.0f %10u %10u %10u\n",
+                    kTargets[t].route,
+                    all.size(),
+                    all.size() / elapsed,
+                    Percentile(all, 0.5),
+                    Percentile(all, 0.99),
+                    Percentile(all, 0.999));
+    }
+    for (auto& s : samples) {
+        errors += s.errors;
+    }
+    std::printf("%-10s %10zu %10.0f, %zu errors\n",
+                "total",
+                total,
+                total / elapsed,
+                errors);
+
+    jp.Shutdown(std::chrono::seconds(5));
+    return 0;
+}
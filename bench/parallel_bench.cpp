@@ -0,0 +1,90 @@
+// Measures how a ParallelWebJob speeds up with the threads of its pool: the
+// permutations of a string, split by their first two letters as the
+// example's PermutationJob does, each checked against a sum so that the work
+// cannot be optimized out.
+//
+//   parallel-bench [string length]
+
+#include <httpi/parallel-job.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PermuteJob : public ParallelWebJob {
+    std::string str_;
+    std::vector<std::string> starts_;
+    std::atomic<uint64_t> checksum_{0};
+
+   public:
+    PermuteJob(WebJobsPool& jp, std::string str)
+        : ParallelWebJob(jp), str_(std::move(str)) {}
+
+    std::string name() const override { return "Permute"; }
+    uint64_t checksum() const { return checksum_; }
+
+   protected:
+    size_t Split() override {
+        std::sort(str_.begin(), str_.end());
+        for (size_t i = 0; i < str_.size(); ++i) {
+            for (size_t j = 0; j < str_.size(); ++j) {
+                if (i != j) {
+                    std::string rest = str_;
+                    rest.erase(std::max(i, j), 1);
+                    rest.erase(std::min(i, j), 1);
+                    starts_.push_back(std::string{str_[i], str_[j]} + rest);
+                }
+            }
+        }
+        return starts_.size();
+    }
+
+    void RunChunk(size_t chunk) override {
+        std::string s = starts_[chunk];
+        uint64_t sum = 0, n = 0;
+        do {
+            sum += s[s.size() / 2] * ++n;
+            if (n % 1000 == 0) {
+                AddProgress(1000);
+            }
+        } while (std::next_permutation(s.begin() + 2, s.end()));
+        AddProgress(n % 1000);
+        checksum_ += sum;
+    }
+};
+
+int main(int argc, char** argv) {
+    size_t length = argc > 1 ? std::atol(argv[1]) : 11;
+    std::string str;
+    for (size_t i = 0; i < length; ++i) {
+        str += 'a' + i;
+    }
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    double single = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        WebJobsPool jp(threads);
+        auto begin = std::chrono::steady_clock::now();
+        auto job = std::make_unique<PermuteJob>(jp, str);
+        PermuteJob* p = job.get();
+        size_t id = jp.StartJob(std::move(job));
+        while (!jp.GetId(id)->IsFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+        if (threads == 1) {
+            single = ms;
+        }
+        std::cout << threads << " threads: " << ms << " ms, speedup "
+                  << single / ms << " (checksum " << p->checksum() << ", "
+                  << p->progress().current << " permutations)\n";
+    }
+    return 0;
+}
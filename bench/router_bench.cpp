@@ -0,0 +1,90 @@
+// Compares url lookup in httpi::Router against the std::map keyed on the exact
+// url that HTTPServer used before.
+//
+//   router-bench [routes] [lookups]
+
+#include <httpi/router.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+template <class F>
+double NsPerOp(size_t ops, F&& f) {
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / ops;
+}
+
+int main(int argc, char** argv) {
+    size_t nb_routes = argc > 1 ? std::atoi(argv[1]) : 500;
+    size_t nb_lookups = argc > 2 ? std::atoi(argv[2]) : 2000000;
+
+    // Looks like a REST api: a few hundred resources sharing long prefixes.
+    std::vector<std::string> urls;
+    std::vector<std::string> param_urls;
+    std::map<std::string, int> map;
+    httpi::Router<int> router;
+    httpi::Router<int> param_router;
+    for (size_t i = 0; urls.size() < nb_routes; ++i) {
+        for (size_t j = 0; j < 10 && urls.size() < nb_routes; ++j) {
+            std::string prefix = "/api/v1/resource" + std::to_string(i);
+            std::string action = "/action" + std::to_string(j);
+
+            urls.push_back(prefix + action);
+            map.emplace(urls.back(), urls.size());
+            router.Insert(urls.back(), urls.size());
+
+            param_router.Insert(prefix + "/:id" + action, urls.size());
+            param_urls.push_back(prefix + "/123456" + action);
+        }
+    }
+
+    // MHD hands us the url as a C string: include building the key in the
+    // map's cost, as HTTPServer::Execute had to.
+    std::vector<const char*> url_order;
+    std::vector<const char*> param_order;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, urls.size() - 1);
+    for (size_t i = 0; i < 4096; ++i) {
+        size_t r = pick(rng);
+        url_order.push_back(urls[r].c_str());
+        param_order.push_back(param_urls[r].c_str());
+    }
+
+    long checksum = 0;
+    double map_ns = NsPerOp(nb_lookups, [&]() {
+        for (size_t i = 0; i < nb_lookups; ++i) {
+            auto res = map.find(url_order[i % url_order.size()]);
+            checksum += res->second;
+        }
+    });
+
+    httpi::PathParams params;
+    double router_ns = NsPerOp(nb_lookups, [&]() {
+        for (size_t i = 0; i < nb_lookups; ++i) {
+            checksum += router.Find(url_order[i % url_order.size()], &params)
+                            ->value;
+        }
+    });
+
+    double param_ns = NsPerOp(nb_lookups, [&]() {
+        for (size_t i = 0; i < nb_lookups; ++i) {
+            auto e = param_router.Find(param_order[i % param_order.size()],
+                                       &params);
+            checksum += e->value + params.Get("id").size();
+        }
+    });
+
+    std::cout << nb_routes << " routes, " << nb_lookups << " lookups\n"
+              << "std::map exact url:    " << map_ns << " ns/lookup\n"
+              << "Router static:         " << router_ns << " ns/lookup\n"
+              << "Router with :id param: " << param_ns << " ns/lookup\n"
+              << "(checksum " << checksum << ")\n";
+    return 0;
+}
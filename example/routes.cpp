@@ -0,0 +1,767 @@
+#include <utility>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <httpi/dag-job.h>
+#include <httpi/displayer.h>
+#include <httpi/html/form-gen.h>
+#include <httpi/html/json.h>
+#include <httpi/job.h>
+#include <httpi/monitoring.h>
+#include <httpi/parallel-job.h>
+#include <httpi/rest-helpers.h>
+#include <httpi/upload.h>
+
+#include "routes.h"
+
+// The pages of a toy app
+
+using namespace httpi::html;
+
+static const FormDescriptor<std::string> permute_form_desc = {
+    "POST",
+    "/permute",
+    "Permutations",
+    "Permute a string",
+    {{"str", "text", "String to permute"}}};
+
+static const std::string permutation_form = permute_form_desc.MakeForm().Get();
+
+// Splits the permutations by their first two letters, and lists each chunk
+// once those before it are: in the order a single thread would.
+class PermutationJob : public ParallelWebJob {
+    int factorial(int n) {
+        return (n == 1 || n == 0) ? 1 : factorial(n - 1) * n;
+    }
+
+    // The first permutation of `sorted` starting with each distinct prefix
+    // of `len` letters, in order.
+    static void Starts(const std::string& sorted,
+                       size_t len,
+                       const std::string& prefix,
+                       std::vector<std::string>* out) {
+        if (len == 0) {
+            out->push_back(prefix + sorted);
+            return;
+        }
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            if (i > 0 && sorted[i] == sorted[i - 1]) {
+                continue;
+            }
+            std::string rest = sorted;
+            rest.erase(i, 1);
+            Starts(rest, len - 1, prefix + sorted[i], out);
+        }
+    }
+
+    // Permutations found so far, sealed by batches. Shared with the pages
+    // streaming them, which can outlive the job.
+    struct Results {
+        std::mutex guard;
+        std::vector<httpi::Response::Buffer> batches;
+        bool done = false;
+        // The pages waiting for more.
+        std::vector<std::function<void()>> waiting;
+
+        // Wakes the pages waiting, after releasing `lk`.
+        void WakeAll(std::unique_lock<std::mutex>* lk) {
+            std::vector<std::function<void()>> wake;
+            wake.swap(waiting);
+            lk->unlock();
+            for (auto& w : wake) {
+                w();
+            }
+        }
+    };
+
+    // A chunk done, waiting for those before it to be listed.
+    struct Chunk {
+        std::vector<httpi::Response::Buffer> batches;
+        uint64_t permutations = 0;
+    };
+
+    static const int kBatchSize = 1000;
+
+    std::string str_;
+    std::shared_ptr<Results> results_;
+    // Set by Split(): the first permutation of each chunk, the length of the
+    // prefix they are split by, and the first chunk to run, those before it
+    // having been listed before a restart.
+    std::vector<std::string> starts_;
+    size_t prefix_ = 0;
+    size_t first_ = 0;
+    // Guarded by `results_->guard` once the job runs: the chunks done and
+    // not listed yet, then how many chunks and permutations are listed.
+    std::map<size_t, Chunk> finished_;
+    size_t listed_ = 0;
+    uint64_t listed_permutations_ = 0;
+
+    // Lists the chunks done which follow the ones listed, and checkpoints
+    // after them.
+    void Finish(size_t chunk, Chunk done) {
+        std::unique_lock<std::mutex> lk(results_->guard);
+        finished_[chunk] = std::move(done);
+        size_t listed = listed_;
+        for (auto it = finished_.begin();
+             it != finished_.end() && it->first == listed_;
+             it = finished_.erase(it)) {
+            results_->batches.insert(results_->batches.end(),
+                                     it->second.batches.begin(),
+                                     it->second.batches.end());
+            listed_permutations_ += it->second.permutations;
+            ++listed_;
+        }
+        if (listed_ != listed) {
+            Checkpoint();
+        }
+        results_->WakeAll(&lk);
+    }
+
+   public:
+    PermutationJob(WebJobsPool& jp, const std::string& str)
+        : ParallelWebJob(jp),
+          str_(str),
+          results_(std::make_shared<Results>()) {}
+
+    std::string name() const override { return "Permute"; }
+
+    std::string Summary() const override { return "Permute " + str_; }
+
+    // Resumes after a restart from the chunks listed, with their permutations
+    // gone from the page.
+    std::string kind() const override { return "permute"; }
+
+    std::string SaveState() const override {
+        return std::to_string(listed_) + " " +
+               std::to_string(listed_permutations_) + " " +
+               std::to_string(str_.size()) + "\n" + str_;
+    }
+
+    bool RestoreState(const std::string& state) override {
+        unsigned long long permutations;
+        size_t listed, size;
+        int header = 0;
+        if (std::sscanf(state.c_str(),
+                        "%zu %llu %zu%n",
+                        &listed,
+                        &permutations,
+                        &size,
+                        &header) != 3 ||
+            state[header++] != '\n' || state.size() - header != size) {
+            return false;
+        }
+        str_ = state.substr(header);
+        listed_ = listed;
+        listed_permutations_ = permutations;
+        return true;
+    }
+
+    size_t result_bytes() const override {
+        std::lock_guard<std::mutex> lk(results_->guard);
+        size_t bytes = WebJob::result_bytes();
+        for (auto& b : results_->batches) {
+            bytes += b->size();
+        }
+        return bytes;
+    }
+
+   protected:
+    size_t Split() override {
+        std::string sorted = str_;
+        std::sort(sorted.begin(), sorted.end());
+        prefix_ = std::min<size_t>(2, sorted.empty() ? 0 : sorted.size() - 1);
+        Starts(sorted, prefix_, "", &starts_);
+        first_ = std::min(listed_, starts_.size());
+
+        SetTotal(factorial(sorted.size()));
+        SetStatus("Running");
+        SetProgress(listed_permutations_);
+        return starts_.size() - first_;
+    }
+
+    void RunChunk(size_t chunk) override {
+        std::string str = starts_[first_ + chunk];
+        Chunk done;
+        std::string batch;
+        int in_batch = 0;
+        do {
+            batch += (Html() << Li() << str << Close()).Get();
+            ++done.permutations;
+            if (++in_batch == kBatchSize) {
+                done.batches.push_back(
+                    std::make_shared<const std::string>(std::move(batch)));
+                batch.clear();
+                AddProgress(in_batch);
+                in_batch = 0;
+            }
+        } while (!cancelled() &&
+                 std::next_permutation(str.begin() + prefix_, str.end()));
+        if (!batch.empty()) {
+            done.batches.push_back(
+                std::make_shared<const std::string>(std::move(batch)));
+        }
+        AddProgress(in_batch);
+
+        // Cut short: runs again on restart.
+        if (!cancelled()) {
+            Finish(first_ + chunk, std::move(done));
+        }
+    }
+
+    void Merge() override {
+        {
+            std::unique_lock<std::mutex> lk(results_->guard);
+            results_->done = true;
+            results_->WakeAll(&lk);
+        }
+        SetStatus(cancelled() ? std::string("Stopped: ") +
+                                    httpi::ReasonName(cancel_token()->reason())
+                              : "Done");
+        std::cout << "Stop permutations\n";
+    }
+
+   public:
+    // Streams the permutations, following the job until it ends: the page
+    // starts arriving at once and is never built as a whole. Waiting for the
+    // next batch holds no server thread.
+    httpi::Response Render() override {
+        auto results = results_;
+        size_t next = 0;
+        return httpi::Response((Html() << H1() << name() << Close()).Get())
+            .Append(page())
+            .Append(Ul().OpeningTag())
+            .Pull([results, next](std::string* out,
+                                  const std::function<void()>& wake) mutable {
+                std::lock_guard<std::mutex> lk(results->guard);
+                if (next < results->batches.size()) {
+                    *out = *results->batches[next++];
+                    return httpi::Response::Pulled::kMore;
+                }
+                if (results->done) {
+                    return httpi::Response::Pulled::kEnd;
+                }
+                results->waiting.push_back(wake);
+                return httpi::Response::Pulled::kWait;
+            })
+            .Append("</ul>");
+    }
+};
+
+// Counts the lines of an uploaded file while it is being uploaded.
+class LineCountJob : public WebJob {
+    std::shared_ptr<httpi::UploadPipe> pipe_;
+    // Written before the byte count is published as the progress.
+    std::atomic<size_t> lines_{0};
+
+    std::string Counts(const Progress& p) const {
+        return std::to_string(p.current) + " bytes, " +
+               std::to_string(lines_.load(std::memory_order_relaxed)) +
+               " lines";
+    }
+
+   public:
+    explicit LineCountJob(std::shared_ptr<httpi::UploadPipe> pipe)
+        : pipe_(std::move(pipe)) {}
+
+    std::string name() const override { return "Line count"; }
+
+    std::string Summary() const override {
+        Progress p = progress();
+        return name() + ": " + Counts(p) + ", " + p.status;
+    }
+
+    void OnCancel() override { pipe_->Cancel(); }
+
+    void Do() override {
+        SetStatus("Uploading");
+        size_t bytes = 0;
+        size_t lines = 0;
+        std::string chunk;
+        while (pipe_->Read(&chunk)) {
+            bytes += chunk.size();
+            lines += std::count(chunk.begin(), chunk.end(), '\n');
+            lines_.store(lines, std::memory_order_relaxed);
+            SetProgress(bytes);
+        }
+        SetStatus(pipe_->aborted() ? "Upload aborted" : "Done");
+    }
+
+    Html RenderPage(const Progress& p) const override {
+        return Html() << P() << Counts(p) << Close() << P() << p.status
+                      << Close();
+    }
+};
+
+// The page layout around the content, built once and shared by every
+// response.
+// clang-format off
+static const httpi::Response::Buffer page_header =
+    std::make_shared<const std::string>(
+        "<!DOCTYPE html>"
+        "<html>"
+            "<head>"
+            R"(<meta charset="utf-8">)"
+            R"(<meta http-equiv="X-UA-Compatible" content="IE=edge">)"
+            R"(<meta name="viewport" content="width=device-width, initial-scale=1">)"
+            R"(<link rel="stylesheet" href="https://maxcdn.bootstrapcdn.com/bootstrap/3.3.5/css/bootstrap.min.css">)"
+            R"(<link rel="stylesheet" href="//cdn.jsdelivr.net/chartist.js/latest/chartist.min.css">)"
+            R"(<script src="//cdn.jsdelivr.net/chartist.js/latest/chartist.min.js"></script>)"
+            "</head>"
+                "<body lang=\"en\">"
+                    "<div class=\"container\">"
+                         "<div class=\"col-md-9\">");
+
+static const httpi::Response::Buffer page_footer =
+    std::make_shared<const std::string>((Html() <<
+                         "</div>"
+                         "<div class=\"col-md-3\">" <<
+                             Ul() <<
+                                 Li() <<
+                                     A().Attr("href", "/jobs") <<
+                                         "Jobs" <<
+                                     Close() <<
+                                 Close() <<
+                                 Li() <<
+                                     A().Attr("href", "/permute") <<
+                                         "Permute" <<
+                                     Close() <<
+                                 Close() <<
+                                 Li() <<
+                                     A().Attr("href", "/compute") <<
+                                         "Addition" <<
+                                     Close() <<
+                                 Close() <<
+                                 Li() <<
+                                     A().Attr("href", "/pipeline") <<
+                                         "Pipeline" <<
+                                     Close() <<
+                                 Close() <<
+                             Close() <<
+                         "</div>" <<
+                     "</div>" <<
+                 "</body>" <<
+             "</html>").Get());
+// clang-format on
+
+std::string MakePage(const std::string& content) {
+    return *page_header + content + *page_footer;
+}
+
+// Same as MakePage, without copying nor materializing `content`.
+httpi::Response MakeSharedPage(httpi::Response content) {
+    // The layout never changes: the content's ETag also tags the page.
+    return httpi::Response()
+        .ETag(content.etag())
+        .Append(page_header)
+        .Append(std::move(content))
+        .Append(page_footer);
+}
+
+// The page of a job gone from `jp`: its summary if it is still archived.
+static std::string MissingJobPage(WebJobsPool& jp, size_t id) {
+    JobSummary s;
+    if (!jp.GetArchived(id, &s)) {
+        return MakePage((Html() << "not found").Get());
+    }
+    return MakePage((Html() << H2() << s.summary << Close()
+                            << "Finished, and evicted since.")
+                        .Get());
+}
+
+// The page of a job, kept up to date with its events as long as it is open.
+static httpi::Response LiveJobPage(WebJob& job, size_t id) {
+    httpi::Response content = job.Render();
+    std::string etag = content.etag();
+    // Ahead of the content, which may be streamed until the job ends.
+    return MakeSharedPage(
+        httpi::Response()
+            .ETag(std::move(etag))
+            .Append(job.LiveScript("/jobs/" + std::to_string(id) + "/events"))
+            .Append(std::move(content)));
+}
+
+static std::string TimeOfDay(std::chrono::system_clock::time_point t) {
+    std::time_t tt = std::chrono::system_clock::to_time_t(t);
+    std::tm tm;
+    localtime_r(&tt, &tm);
+    char buf[16];
+    std::strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+    return buf;
+}
+
+// The jobs of `jp` currently in `state`.
+static Html JobsTable(WebJobsPool& jp, JobState state) {
+    Html html;
+    // clang-format off
+    html <<
+        Table().AddClass("table") <<
+            Tr() <<
+                Th() << "Job" << Close() <<
+                Th() << "Queued" << Close() <<
+                Th() << "Started" << Close() <<
+                Th() << "Finished" << Close() <<
+                Th() << "Details" << Close() <<
+                Th() << Close() <<
+            Close();
+
+    jp.foreach_job([&html, state](WebJobsPool::job_type& x) {
+        auto& job = *x.second;
+        JobState current = job.state();
+        if (current != state) {
+            return;
+        }
+        std::string id = std::to_string(x.first);
+        const char* cancelled =
+            httpi::ReasonName(job.cancel_token().reason());
+        html <<
+            Tr() <<
+                Td() <<
+                    id << ": " << job.job_data().name() <<
+                    (*cancelled ? std::string(" (") + cancelled + ")" : "") <<
+                Close() <<
+                Td() << TimeOfDay(job.queued_at()) << Close() <<
+                Td() <<
+                    (current != JobState::kQueued
+                         ? TimeOfDay(job.started_at()) : "") <<
+                Close() <<
+                Td() <<
+                    (current == JobState::kFinished
+                         ? TimeOfDay(job.finished_at()) : "") <<
+                Close() <<
+                Td() <<
+                    A().Attr("href", "/jobs/" + id) << "See" << Close() <<
+                Close() <<
+                Td();
+        if (current != JobState::kFinished && !*cancelled) {
+            html <<
+                Form("POST", "/jobs/cancel") <<
+                    Input().Name("id").Attr("type", "hidden").Attr("value", id) <<
+                    Submit().Attr("value", "Cancel") <<
+                Close();
+        }
+        html <<
+                Close() <<
+            Close();
+    });
+
+    html << Close();
+    // clang-format on
+    return html;
+}
+
+// The jobs evicted from `jp`, most recent first.
+static Html ArchiveTable(WebJobsPool& jp) {
+    std::vector<std::string> rows;
+    jp.foreach_archived([&rows](const JobSummary& s) {
+        // clang-format off
+        rows.push_back((Html() <<
+            Tr() <<
+                Td() << std::to_string(s.id) << ": " << s.summary << Close() <<
+                Td() << TimeOfDay(s.queued_at) << Close() <<
+                Td() << TimeOfDay(s.started_at) << Close() <<
+                Td() << TimeOfDay(s.finished_at) << Close() <<
+            Close()).Get());
+        // clang-format on
+    });
+
+    Html html;
+    // clang-format off
+    html <<
+        Table().AddClass("table") <<
+            Tr() <<
+                Th() << "Job" << Close() <<
+                Th() << "Queued" << Close() <<
+                Th() << "Started" << Close() <<
+                Th() << "Finished" << Close() <<
+            Close();
+    // clang-format on
+    for (auto row = rows.rbegin(); row != rows.rend(); ++row) {
+        html << *row;
+    }
+    html << Close();
+    return html;
+}
+
+void RegisterExampleRoutes(HTTPServer& server,
+                           WebJobsPool& jp,
+                           httpi::Journal* journal) {
+    auto t1 = StartWebJob(jp,
+                          std::unique_ptr<MonitoringJob>(
+                              new MonitoringJob(std::chrono::seconds(2), 30)));
+    auto monitoring_job = jp.GetId(t1);
+
+    if (journal) {
+        size_t restored = RestoreWebJobs(
+            jp,
+            journal,
+            {{"permute",
+              [&jp]() { return std::make_unique<PermutationJob>(jp, ""); }}},
+            httpi::Priority::kNormal,
+            std::chrono::minutes(1));
+        std::cout << "Resumed " << restored << " jobs\n";
+    }
+
+    server.RegisterUrl(
+        "/compute",
+        httpi::RestPageMaker(MakePage).AddResource(
+            "GET",
+            httpi::RestResource(
+                FormDescriptor<int, int>{
+                    "GET",
+                    "/compute",
+                    "Compute Stuff",  // name
+                    "Compute a + b",  // longer description
+                    {{"a", "number", "Value A"}, {"b", "number", "Value B"}}},
+                [](int a, int b) { return a + b; },
+                [](int a) { return std::to_string(a); },
+                [](int a) {
+                    return JsonBuilder().Append("result", a).Build();
+                })));
+
+    server.RegisterUrl(
+        "/permute",
+        httpi::RestPageMaker(MakePage).AddResource(
+            "GET",
+            httpi::RestResource(
+                FormDescriptor<std::string>{
+                    "GET",
+                    "/permute",
+                    "Permute Stuff",     // name
+                    "Permute a string",  // longer description
+                    {{"str", "text", "the string"}}},
+                [&jp, journal](const std::string& str) {
+                    // Long strings would run for ages: cut them short.
+                    return StartWebJob(
+                        jp,
+                        std::make_unique<PermutationJob>(jp, str),
+                        httpi::Priority::kNormal,
+                        std::chrono::minutes(1),
+                        journal);
+                },
+                [](int id) {
+                    return Html() << "job_id: " << std::to_string(id);
+                },
+                [](int id) {
+                    return JsonBuilder().Append("job_id", id).Build();
+                })));
+
+    // Both counts run at once once the numbers are there; the report waits
+    // for both.
+    server.RegisterUrl(
+        "/pipeline",
+        httpi::RestPageMaker(MakePage).AddResource(
+            "GET",
+            httpi::RestResource(
+                FormDescriptor<int>{
+                    "GET",
+                    "/pipeline",
+                    "Pipeline",  // name
+                    "Count the primes and the squares up to n",
+                    {{"n", "number", "n"}}},
+                [&jp](int n) {
+                    // The numbers are all held at once.
+                    n = std::min(n, 10000000);
+                    httpi::Dag dag;
+                    auto numbers = dag.Add("numbers", [n]() {
+                        std::vector<int> v;
+                        for (int i = 1; i <= n; ++i) {
+                            v.push_back(i);
+                        }
+                        return v;
+                    });
+                    auto primes = dag.Add(
+                        "primes",
+                        [](const std::vector<int>& v) {
+                            return std::count_if(
+                                v.begin(), v.end(), [](int x) {
+                                    for (int d = 2; d <= x / d; ++d) {
+                                        if (x % d == 0) {
+                                            return false;
+                                        }
+                                    }
+                                    return x > 1;
+                                });
+                        },
+                        numbers);
+                    auto squares = dag.Add(
+                        "squares",
+                        [](const std::vector<int>& v) {
+                            return std::count_if(
+                                v.begin(), v.end(), [](int x) {
+                                    int r = std::sqrt(x);
+                                    return r * r == x;
+                                });
+                        },
+                        numbers);
+                    auto report = dag.Add(
+                        "report",
+                        [n](long p, long s) {
+                            return "Up to " + std::to_string(n) + ": " +
+                                   std::to_string(p) + " primes, " +
+                                   std::to_string(s) + " squares";
+                        },
+                        primes,
+                        squares);
+                    std::string name = "Pipeline " + std::to_string(n);
+                    return StartWebJob(
+                        jp,
+                        std::make_unique<DagJob>(
+                            name, jp, std::move(dag), [report]() {
+                                return report.result();
+                            }));
+                },
+                [](int id) {
+                    return Html() << "job_id: " << std::to_string(id);
+                },
+                [](int id) {
+                    return JsonBuilder().Append("job_id", id).Build();
+                })));
+
+    // The file goes straight to a job as it arrives, never held in memory as
+    // a whole.
+    server.RegisterUploadUrl(
+        "/jobs/upload",
+        [&jp](const std::string& method,
+              const POSTValues&,
+              const httpi::PathParams&) {
+            if (method != "POST") {
+                UploadSink form;
+                form.finish = []() -> httpi::Response {
+                    return MakePage(
+                        R"(<form method="POST" action="/jobs/upload" )"
+                        R"(enctype="multipart/form-data">)"
+                        R"(<input type="file" name="file">)"
+                        R"(<input type="submit" value="Count lines">)"
+                        "</form>");
+                };
+                return form;
+            }
+
+            auto pipe = std::make_shared<httpi::UploadPipe>();
+            // Ahead of the queue: the upload waits for it.
+            size_t id = StartWebJob(jp,
+                                    std::make_unique<LineCountJob>(pipe),
+                                    httpi::Priority::kHigh);
+            return httpi::PipeSink(pipe, "file", [id]() -> httpi::Response {
+                std::string url = "/jobs/" + std::to_string(id);
+                return MakePage(
+                    (Html() << A().Attr("href", url) << "job " << url << Close())
+                        .Get());
+            });
+        },
+        1ull << 30);
+
+    server.RegisterUrl(
+        "/", [monitoring_job, t1](const std::string&, const POSTValues&) {
+            return LiveJobPage(monitoring_job->job_data(), t1);
+        });
+
+    server.RegisterUrl(
+        "/jobs",
+        [&jp](const std::string&, const POSTValues& args) -> httpi::Response {
+            auto id = args.find("id");
+            if (id == args.end()) {
+                return MakePage((Html() << H2() << "Running" << Close()
+                                        << JobsTable(jp, JobState::kRunning)
+                                        << H2() << "Queued" << Close()
+                                        << JobsTable(jp, JobState::kQueued)
+                                        << H2() << "Finished" << Close()
+                                        << JobsTable(jp, JobState::kFinished)
+                                        << H2() << "Archived" << Close()
+                                        << ArchiveTable(jp))
+                                    .Get());
+            } else {
+                Html html;
+                size_t job_id = std::atoi(id->second.c_str());
+                auto job = jp.GetId(job_id);
+
+                if (job == nullptr) {
+                    return MissingJobPage(jp, job_id);
+                }
+
+                return LiveJobPage(job->job_data(), job_id);
+            }
+        });
+
+    server.RegisterUrl(
+        "/jobs/:id",
+        [&jp](const std::string&,
+              const POSTValues&,
+              const httpi::PathParams& params) -> httpi::Response {
+            size_t id = std::atoi(params.Get("id").to_string().c_str());
+            auto job = jp.GetId(id);
+
+            if (job == nullptr) {
+                return MissingJobPage(jp, id);
+            }
+
+            return LiveJobPage(job->job_data(), id);
+        });
+
+    server.RegisterUrl(
+        "/jobs/cancel",
+        [&jp](const std::string& method,
+              const POSTValues& args) -> httpi::Response {
+            auto id = args.find("id");
+            if (method != "POST" || id == args.end()) {
+                return httpi::Response("POST an id to cancel")
+                    .Status(MHD_HTTP_BAD_REQUEST);
+            }
+            jp.Cancel(std::atoi(id->second.c_str()));
+            return httpi::Response()
+                .Status(MHD_HTTP_SEE_OTHER)
+                .Header(MHD_HTTP_HEADER_LOCATION, "/jobs");
+        });
+
+    // Pushes the job's progress as it happens, see WebJob::events(). The
+    // connection holds no thread between two events.
+    server.RegisterUrl(
+        "/jobs/:id/events",
+        [&jp](const std::string&,
+              const POSTValues& headers,
+              const httpi::PathParams& params) -> httpi::Response {
+            size_t id = std::atoi(params.Get("id").to_string().c_str());
+            auto job = jp.GetId(id);
+
+            if (job == nullptr) {
+                // Gone for good: do not let EventSource reconnect.
+                return httpi::Response().Status(MHD_HTTP_NO_CONTENT);
+            }
+
+            auto last = headers.find("Last-Event-ID");
+            return job->job_data().events().Subscribe(
+                last == headers.end()
+                    ? 0
+                    : std::strtoull(last->second.c_str(), nullptr, 10));
+        });
+
+    // Answers once the job is over, without holding a server thread while
+    // waiting.
+    server.RegisterAsyncUrl(
+        "/jobs/:id/wait",
+        [&jp](const std::string&,
+              const POSTValues&,
+              const httpi::PathParams& params,
+              Responder done) {
+            size_t id = std::atoi(params.Get("id").to_string().c_str());
+            auto job = jp.GetId(id);
+
+            if (job == nullptr) {
+                done(MissingJobPage(jp, id));
+                return;
+            }
+
+            job->OnFinished([job, done]() {
+                done(MakeSharedPage(job->job_data().Render()));
+            });
+        });
+}
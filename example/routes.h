@@ -0,0 +1,14 @@
+#pragma once
+
+#include <httpi/displayer.h>
+#include <httpi/journal.h>
+#include <httpi/webjob.h>
+
+// Registers the pages of the demo app on `server`, and starts its monitoring
+// job in `jp`. The jobs started by the pages also go to `jp`, which must
+// outlive the server. Given a `journal`, which must outlive `jp`, the jobs
+// which can are checkpointed to it, and those a previous run left there are
+// resumed.
+void RegisterExampleRoutes(HTTPServer& server,
+                           WebJobsPool& jp,
+                           httpi::Journal* journal = nullptr);
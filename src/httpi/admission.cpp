@@ -0,0 +1,87 @@
+#include "admission.h"
+
+namespace httpi {
+
+Admission::Decision Admission::Enter(const void* key,
+                                     std::function<void()> admit) {
+    if (max_in_flight_ == 0) {
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+        admitted_.fetch_add(1, std::memory_order_relaxed);
+        return Decision::kRun;
+    }
+
+    std::lock_guard<std::mutex> lk(guard_);
+    if (in_flight_.load(std::memory_order_relaxed) < max_in_flight_) {
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+        admitted_.fetch_add(1, std::memory_order_relaxed);
+        return Decision::kRun;
+    }
+    if (queue_.size() < max_queued_) {
+        queue_.emplace_back(key, std::move(admit));
+        delayed_.fetch_add(1, std::memory_order_relaxed);
+        return Decision::kQueued;
+    }
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return Decision::kRejected;
+}
+
+void Admission::Leave() {
+    if (max_in_flight_ == 0) {
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(guard_);
+    if (queue_.empty()) {
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+    // The slot goes to the next request without ever being free.
+    auto next = std::move(queue_.front());
+    queue_.pop_front();
+    admitted_.fetch_add(1, std::memory_order_relaxed);
+    next.second();
+}
+
+bool Admission::Cancel(const void* key) {
+    std::lock_guard<std::mutex> lk(guard_);
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+        if (it->first == key) {
+            queue_.erase(it);
+            cancelled_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t Admission::queued() const {
+    std::lock_guard<std::mutex> lk(guard_);
+    return queue_.size();
+}
+
+void Admission::WritePrometheus(std::string* out) const {
+    *out +=
+        "# HELP httpi_admission_total Requests given a slot, made to wait for "
+        "one, rejected with a 503, or gone while waiting.\n"
+        "# TYPE httpi_admission_total counter\n"
+        "httpi_admission_total{decision=\"admitted\"} " +
+        std::to_string(admitted_.load(std::memory_order_relaxed)) +
+        "\nhttpi_admission_total{decision=\"queued\"} " +
+        std::to_string(delayed_.load(std::memory_order_relaxed)) +
+        "\nhttpi_admission_total{decision=\"rejected\"} " +
+        std::to_string(rejected_.load(std::memory_order_relaxed)) +
+        "\nhttpi_admission_total{decision=\"cancelled\"} " +
+        std::to_string(cancelled_.load(std::memory_order_relaxed)) +
+        "\n# HELP httpi_requests_in_flight Requests between their handler "
+        "being called and their response being ready.\n"
+        "# TYPE httpi_requests_in_flight gauge\n"
+        "httpi_requests_in_flight " +
+        std::to_string(in_flight()) +
+        "\n# HELP httpi_requests_queued Requests waiting for a slot.\n"
+        "# TYPE httpi_requests_queued gauge\n"
+        "httpi_requests_queued " +
+        std::to_string(queued()) + "\n";
+}
+
+}  // httpi
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace httpi {
+
+// Decides which requests run their handler now, which wait for a slot, and
+// which are turned away, so that a burst degrades into fast refusals rather
+// than slowing every request down together.
+//
+// With no limit on requests in flight, entering and leaving are a couple of
+// relaxed atomic operations.
+class Admission {
+   public:
+    enum class Decision { kRun, kQueued, kRejected };
+
+    // 0 `max_in_flight` for no limit. Past `max_queued` waiting requests,
+    // new ones are rejected.
+    Admission(size_t max_in_flight, size_t max_queued)
+        : max_in_flight_(max_in_flight), max_queued_(max_queued) {}
+
+    Admission(const Admission&) = delete;
+    Admission& operator=(const Admission&) = delete;
+
+    // Asks for a slot for the request `key`. On kQueued, `admit` is called
+    // once a slot is handed to it, from the thread freeing that slot and with
+    // this object locked: it must not call back into it. Every kRun and every
+    // admitted request must Leave() eventually.
+    Decision Enter(const void* key, std::function<void()> admit);
+
+    // Frees a slot, handing it over to the oldest queued request if any.
+    void Leave();
+
+    // Takes `key` out of the queue. Returns false if it was not there, that
+    // is if it was admitted already.
+    bool Cancel(const void* key);
+
+    size_t in_flight() const {
+        return in_flight_.load(std::memory_order_relaxed);
+    }
+    size_t queued() const;
+
+    // Appends the counters in the Prometheus text exposition format.
+    void WritePrometheus(std::string* out) const;
+
+   private:
+    const size_t max_in_flight_;
+    const size_t max_queued_;
+
+    mutable std::mutex guard_;
+    std::deque<std::pair<const void*, std::function<void()>>> queue_;
+    std::atomic<size_t> in_flight_{0};
+
+    std::atomic<uint64_t> admitted_{0};
+    std::atomic<uint64_t> delayed_{0};
+    std::atomic<uint64_t> rejected_{0};
+    std::atomic<uint64_t> cancelled_{0};
+};
+
+}  // httpi
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <boost/utility/string_ref.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <scoped_allocator>
+#include <string>
+#include <utility>
+
+namespace httpi {
+
+// Hands out memory from large blocks and takes it all back at once. Each
+// connection owns one for the data of its current request, so that parsing a
+// request does not go through malloc once the arena has grown to the size of
+// a typical request. Not thread safe.
+class Arena {
+   public:
+    // Past `max_kept` bytes, Reset() frees the memory instead of keeping it.
+    explicit Arena(size_t block_size = 4096, size_t max_kept = 64 << 10)
+        : initial_block_size_(block_size),
+          block_size_(block_size),
+          max_kept_(max_kept) {}
+    ~Arena() { Free(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t align) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) &
+                      ~(uintptr_t)(align - 1);
+        if (!head_ || p + size > reinterpret_cast<uintptr_t>(end_)) {
+            Grow(size + align);
+            p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) &
+                ~(uintptr_t)(align - 1);
+        }
+        cur_ = reinterpret_cast<char*>(p + size);
+        return reinterpret_cast<void*>(p);
+    }
+
+    // Forgets every allocation. If the last request needed more than one
+    // block, they are merged into one large enough for it, so that the next
+    // request of that size does not allocate. Unless that is more than
+    // `max_kept`: a rare large request, like a big form, does not pin its
+    // memory in an idle arena; the arena starts over from one small block.
+    void Reset() {
+        if (capacity() > max_kept_) {
+            Free();
+            block_size_ = initial_block_size_;
+        } else if (head_ && head_->next) {
+            size_t total = capacity();
+            Free();
+            block_size_ = total;
+            Grow(0);
+        }
+        if (head_) {
+            cur_ = head_->data();
+        }
+    }
+
+    // Bytes held, used or not.
+    size_t capacity() const {
+        size_t total = 0;
+        for (Block* b = head_; b; b = b->next) {
+            total += b->size;
+        }
+        return total;
+    }
+
+   private:
+    struct Block {
+        Block* next;
+        size_t size;
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    void Grow(size_t at_least) {
+        size_t size = std::max(block_size_, at_least);
+        Block* b = static_cast<Block*>(::operator new(sizeof(Block) + size));
+        b->next = head_;
+        b->size = size;
+        head_ = b;
+        cur_ = b->data();
+        end_ = cur_ + size;
+    }
+
+    void Free() {
+        while (head_) {
+            Block* next = head_->next;
+            ::operator delete(head_);
+            head_ = next;
+        }
+        cur_ = end_ = nullptr;
+    }
+
+    const size_t initial_block_size_;
+    size_t block_size_;
+    const size_t max_kept_;
+    Block* head_ = nullptr;
+    char* cur_ = nullptr;
+    char* end_ = nullptr;
+};
+
+// Allocates from an Arena, or from the heap when default constructed.
+// Containers copied from an arena backed one use the heap, so that copies can
+// outlive the request.
+template <class T>
+class ArenaAllocator {
+   public:
+    typedef T value_type;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& a) : arena_(a.arena()) {}
+
+    T* allocate(size_t n) {
+        if (!arena_) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t) {
+        if (!arena_) {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+
+    Arena* arena() const { return arena_; }
+
+   private:
+    Arena* arena_ = nullptr;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>
+    ArenaString;
+
+// An ArenaString which converts to a std::string, so that code written for
+// std::string values keeps working: the copies are on the heap and may
+// outlive the arena.
+class ArenaStringValue : public ArenaString {
+   public:
+    using ArenaString::ArenaString;
+
+    operator std::string() const { return std::string(data(), size()); }
+
+    friend bool operator==(const ArenaStringValue& a, const std::string& b) {
+        return a.compare(0, a.size(), b.data(), b.size()) == 0;
+    }
+    friend bool operator==(const std::string& a, const ArenaStringValue& b) {
+        return b == a;
+    }
+    friend bool operator!=(const ArenaStringValue& a, const std::string& b) {
+        return !(a == b);
+    }
+    friend bool operator!=(const std::string& a, const ArenaStringValue& b) {
+        return !(b == a);
+    }
+    // Also taken by the std::string ones, which would make them ambiguous.
+    friend bool operator==(const ArenaStringValue& a, const char* b) {
+        return a.compare(b) == 0;
+    }
+    friend bool operator==(const char* a, const ArenaStringValue& b) {
+        return b == a;
+    }
+    friend bool operator!=(const ArenaStringValue& a, const char* b) {
+        return !(a == b);
+    }
+    friend bool operator!=(const char* a, const ArenaStringValue& b) {
+        return !(b == a);
+    }
+};
+
+// Orders strings whatever their allocator, C strings and string_refs, so that
+// looking up a key of any of these types does not convert it.
+struct StringLess {
+    typedef void is_transparent;
+
+    template <class A, class B>
+    bool operator()(const A& a, const B& b) const {
+        return View(a) < View(b);
+    }
+
+   private:
+    static boost::string_ref View(const char* s) { return s; }
+    static boost::string_ref View(boost::string_ref s) { return s; }
+    template <class Alloc>
+    static boost::string_ref View(
+        const std::basic_string<char, std::char_traits<char>, Alloc>& s) {
+        return boost::string_ref(s.data(), s.size());
+    }
+};
+
+// A string map whose nodes and strings all live in one arena.
+typedef std::map<ArenaString,
+                 ArenaStringValue,
+                 StringLess,
+                 std::scoped_allocator_adaptor<ArenaAllocator<
+                     std::pair<const ArenaString, ArenaStringValue>>>>
+    ArenaStringMap;
+
+}  // httpi
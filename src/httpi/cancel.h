@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace httpi {
+
+// Asks a job to stop. Jobs poll cancelled(), which is a single load, between
+// steps of their work; those blocked somewhere polling does not reach
+// register an OnCancel callback to unblock themselves.
+class CancelToken {
+   public:
+    enum class Reason { kNone, kCancelled, kDeadline, kShutdown };
+
+    CancelToken() = default;
+    CancelToken(const CancelToken&) = delete;
+    CancelToken& operator=(const CancelToken&) = delete;
+
+    bool cancelled() const {
+        return reason_.load(std::memory_order_relaxed) != Reason::kNone;
+    }
+    Reason reason() const { return reason_.load(std::memory_order_relaxed); }
+
+    // Only the first cancellation counts. Runs the callbacks on this thread.
+    void Cancel(Reason reason = Reason::kCancelled) {
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::lock_guard<std::mutex> lk(guard_);
+            if (cancelled()) {
+                return;
+            }
+            reason_.store(reason, std::memory_order_relaxed);
+            callbacks.swap(callbacks_);
+        }
+        woken_.notify_all();
+        for (auto& f : callbacks) {
+            f();
+        }
+    }
+
+    // Calls `f` once cancelled, right away if already.
+    void OnCancel(std::function<void()> f) {
+        {
+            std::lock_guard<std::mutex> lk(guard_);
+            if (!cancelled()) {
+                callbacks_.push_back(std::move(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    // Sleeps for `d`, or until cancelled. Returns false if cancelled.
+    template <class Rep, class Period>
+    bool SleepFor(std::chrono::duration<Rep, Period> d) {
+        std::unique_lock<std::mutex> lk(guard_);
+        return !woken_.wait_for(lk, d, [this]() { return cancelled(); });
+    }
+
+   private:
+    std::atomic<Reason> reason_{Reason::kNone};
+    std::mutex guard_;
+    std::condition_variable woken_;
+    std::vector<std::function<void()>> callbacks_;
+};
+
+inline const char* ReasonName(CancelToken::Reason reason) {
+    switch (reason) {
+        case CancelToken::Reason::kNone:
+            return "";
+        case CancelToken::Reason::kCancelled:
+            return "cancelled";
+        case CancelToken::Reason::kDeadline:
+            return "deadline exceeded";
+        case CancelToken::Reason::kShutdown:
+            return "shut down";
+    }
+    return "";
+}
+
+}  // httpi
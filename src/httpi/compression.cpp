@@ -0,0 +1,158 @@
+#include "compression.h"
+
+#include <strings.h>
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace httpi {
+
+// Returns the q value given to `coding` in an Accept-Encoding header, or -1
+// if it is not listed.
+static double QValue(const char* header, const char* coding) {
+    size_t len = std::strlen(coding);
+    const char* s = header;
+    while (*s) {
+        while (*s == ' ' || *s == ',') {
+            ++s;
+        }
+        const char* end = s;
+        while (*end && *end != ',' && *end != ';' && *end != ' ') {
+            ++end;
+        }
+        bool match = static_cast<size_t>(end - s) == len &&
+                     strncasecmp(s, coding, len) == 0;
+
+        double q = 1;
+        const char* next = end;
+        while (*next && *next != ',') {
+            ++next;
+        }
+        const char* params = std::strstr(end, "q=");
+        if (params && params < next) {
+            q = std::atof(params + 2);
+        }
+
+        if (match) {
+            return q;
+        }
+        s = next;
+    }
+    return -1;
+}
+
+ContentEncoding NegotiateEncoding(const char* accept_encoding) {
+    if (!accept_encoding) {
+        return ContentEncoding::kIdentity;
+    }
+    if (QValue(accept_encoding, "gzip") > 0) {
+        return ContentEncoding::kGzip;
+    }
+    if (QValue(accept_encoding, "deflate") > 0) {
+        return ContentEncoding::kDeflate;
+    }
+    return ContentEncoding::kIdentity;
+}
+
+const char* EncodingName(ContentEncoding enc) {
+    switch (enc) {
+        case ContentEncoding::kGzip:
+            return "gzip";
+        case ContentEncoding::kDeflate:
+            return "deflate";
+        case ContentEncoding::kIdentity:
+            break;
+    }
+    return "identity";
+}
+
+Response::Buffer Compress(const Response& resp,
+                          ContentEncoding enc,
+                          int level) {
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+    // 16 more window bits ask zlib for a gzip wrapper instead of a zlib one.
+    int window_bits = enc == ContentEncoding::kGzip ? 15 + 16 : 15;
+    if (deflateInit2(&z, level, Z_DEFLATED, window_bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+    }
+
+    std::string out;
+    out.resize(deflateBound(&z, resp.size()));
+    z.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    z.avail_out = out.size();
+
+    const auto& body = resp.body();
+    for (size_t i = 0; i < body.size(); ++i) {
+        const std::string& in = *body[i].buffer;
+        z.next_in =
+            reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        z.avail_in = in.size();
+        deflate(&z, i + 1 == body.size() ? Z_FINISH : Z_NO_FLUSH);
+    }
+    if (body.empty()) {
+        deflate(&z, Z_FINISH);
+    }
+
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+Response::Buffer CompressionCache::Get(const std::string& url,
+                                       const Response& resp,
+                                       ContentEncoding enc,
+                                       int level) {
+    if (resp.etag().empty()) {
+        return Compress(resp, enc, level);
+    }
+
+    // ETags only tell apart the versions of one url: different routes may
+    // well tag their pages alike.
+    std::string key = url + ' ' + resp.etag() + EncodingName(enc);
+    {
+        std::lock_guard<std::mutex> lk(guard_);
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, found->second);
+            ++hits_;
+            return found->second->second;
+        }
+        ++misses_;
+    }
+
+    // Compress outside the lock. Two threads missing on the same page at once
+    // both compress it, and the second one keeps its own copy.
+    Response::Buffer compressed = Compress(resp, enc, level);
+    if (!compressed || compressed->size() > max_bytes_) {
+        return compressed;
+    }
+
+    std::lock_guard<std::mutex> lk(guard_);
+    if (index_.count(key)) {
+        return compressed;
+    }
+    lru_.emplace_front(key, compressed);
+    index_.emplace(std::move(key), lru_.begin());
+    bytes_ += compressed->size();
+    while (bytes_ > max_bytes_) {
+        bytes_ -= lru_.back().second->size();
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    return compressed;
+}
+
+size_t CompressionCache::hits() const {
+    std::lock_guard<std::mutex> lk(guard_);
+    return hits_;
+}
+
+size_t CompressionCache::misses() const {
+    std::lock_guard<std::mutex> lk(guard_);
+    return misses_;
+}
+
+}  // httpi
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "response.h"
+
+namespace httpi {
+
+enum class ContentEncoding { kIdentity, kGzip, kDeflate };
+
+// Picks the encoding to answer with from an Accept-Encoding header, gzip
+// first. Encodings listed with q=0 are refused.
+ContentEncoding NegotiateEncoding(const char* accept_encoding);
+
+// The Content-Encoding token for `enc`.
+const char* EncodingName(ContentEncoding enc);
+
+// Compresses the concatenated body of `resp`, which must not be streamed.
+Response::Buffer Compress(const Response& resp,
+                          ContentEncoding enc,
+                          int level);
+
+// Keeps the compressed form of recently sent bodies, keyed on their url, ETag
+// and encoding, so that a page is compressed once per version rather than once
+// per request. Least recently used entries are dropped past `max_bytes`.
+class CompressionCache {
+   public:
+    explicit CompressionCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+    // Returns the compressed body of `resp`, answering `url`, compressing it
+    // on a miss. Responses without an ETag are compressed and not cached.
+    Response::Buffer Get(const std::string& url,
+                         const Response& resp,
+                         ContentEncoding enc,
+                         int level);
+
+    size_t hits() const;
+    size_t misses() const;
+
+   private:
+    typedef std::pair<std::string, Response::Buffer> Entry;
+
+    mutable std::mutex guard_;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0;
+    const size_t max_bytes_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+}  // httpi
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "dag.h"
+#include "html/html.h"
+#include "webjob.h"
+
+// Runs an httpi::Dag as one job of `jp`: listed and cancelled as a whole.
+// Its stages run on the threads of `jp` as their dependencies complete, and
+// its page shows where each of them is at.
+class DagJob : public WebJob {
+    static const char* StateName(httpi::Dag::StageState state) {
+        switch (state) {
+            case httpi::Dag::StageState::kWaiting:
+                return "waiting";
+            case httpi::Dag::StageState::kRunning:
+                return "running";
+            case httpi::Dag::StageState::kDone:
+                return "done";
+            case httpi::Dag::StageState::kSkipped:
+                return "skipped";
+            case httpi::Dag::StageState::kFailed:
+                return "failed";
+        }
+        return "";
+    }
+
+    std::string name_;
+    WebJobsPool& jp_;
+    httpi::Dag dag_;
+    const std::function<std::string()> result_;
+    const httpi::Priority priority_;
+
+   public:
+    // `jp` runs the job and its stages: it must outlive the job. Once all
+    // stages are done, `result`, if any, is shown as the job's status; it
+    // usually reads the result of the last stage.
+    DagJob(std::string name,
+           WebJobsPool& jp,
+           httpi::Dag dag,
+           std::function<std::string()> result = nullptr,
+           httpi::Priority priority = httpi::Priority::kNormal)
+        : name_(std::move(name)),
+          jp_(jp),
+          dag_(std::move(dag)),
+          result_(std::move(result)),
+          priority_(priority) {}
+
+    std::string name() const override { return name_; }
+
+    std::string Summary() const override {
+        return name_ + " (" + std::to_string(dag_.size()) + " stages)";
+    }
+
+    // The stages not started once cancelled are skipped. A stage throwing
+    // fails the job, once the stages not depending on it are done.
+    void Do() override {
+        SetTotal(dag_.size());
+        SetStatus("Running");
+        WebJobsPool& jp = jp_;
+        httpi::Priority priority = priority_;
+        dag_.Run(
+            [&jp, priority](std::function<void()> task) {
+                jp.Submit(std::move(task), priority);
+            },
+            *cancel_token(),
+            [this](size_t done) { SetProgress(done); },
+            [this]() { Refresh(); });
+        if (cancelled()) {
+            SetStatus(std::string("Stopped: ") +
+                      httpi::ReasonName(cancel_token()->reason()));
+        } else {
+            SetStatus(result_ ? "Done: " + result_() : "Done");
+        }
+    }
+
+    // The progress, then a row per stage; refreshed as stages change.
+    httpi::html::Html RenderPage(const Progress& p) const override {
+        using namespace httpi::html;
+        Html html = WebJob::RenderPage(p);
+        // clang-format off
+        html <<
+            Table().AddClass("table") <<
+                Tr() <<
+                    Th() << "Stage" << Close() <<
+                    Th() << "Depends on" << Close() <<
+                    Th() << "State" << Close() <<
+                    Th() << "Time" << Close() <<
+                Close();
+        // clang-format on
+        for (auto& s : dag_.Stages()) {
+            std::string deps;
+            for (auto& d : s.depends_on) {
+                deps += (deps.empty() ? "" : ", ") + d;
+            }
+            std::string time =
+                s.state == httpi::Dag::StageState::kDone
+                    ? std::to_string(
+                          std::chrono::duration_cast<
+                              std::chrono::milliseconds>(s.duration)
+                              .count()) +
+                          " ms"
+                    : "";
+            // clang-format off
+            html <<
+                Tr() <<
+                    Td() << s.name << Close() <<
+                    Td() << deps << Close() <<
+                    Td() << StateName(s.state) << Close() <<
+                    Td() << time << Close() <<
+                Close();
+            // clang-format on
+        }
+        return html << Close();
+    }
+};
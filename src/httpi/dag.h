@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cancel.h"
+
+namespace httpi {
+
+// Stages of work depending on each other's results, run in parallel as
+// their dependencies complete.
+//
+//     httpi::Dag dag;
+//     auto text = dag.Add("fetch", []() { return Fetch(); });
+//     auto words = dag.Add("words", CountWords, text);
+//     auto lines = dag.Add("lines", CountLines, text);
+//     auto both = dag.Add("report", Report, words, lines);
+//
+// A stage is a function of the results of the stages it depends on, passed
+// as const references, which returns its own (not void). Stages are added
+// after those they depend on, so there cannot be cycles. Once the dag ran,
+// each stage's result is in its handle; the results whose handles are gone
+// are freed.
+class Dag {
+    struct Shared;
+
+   public:
+    enum class StageState { kWaiting, kRunning, kDone, kSkipped, kFailed };
+
+    // The result of a stage, to pass to the stages depending on it.
+    template <class T>
+    class Stage {
+       public:
+        // Once the dag ran, unless the stage was skipped or failed.
+        bool done() const { return static_cast<bool>(*result_); }
+        const T& result() const { return **result_; }
+
+       private:
+        friend class Dag;
+        Stage(size_t index, std::shared_ptr<std::unique_ptr<T>> result)
+            : index_(index), result_(std::move(result)) {}
+
+        size_t index_;
+        // Set by the stage, before the stages depending on it start.
+        std::shared_ptr<std::unique_ptr<T>> result_;
+    };
+
+    // Where a stage is at, for display.
+    struct StageInfo {
+        std::string name;
+        std::vector<std::string> depends_on;
+        StageState state;
+        // Once done.
+        std::chrono::steady_clock::duration duration;
+    };
+
+    Dag() : shared_(std::make_shared<Shared>()) {}
+
+    template <class F, class... Deps>
+    auto Add(std::string name, F f, const Stage<Deps>&... deps)
+        -> Stage<std::decay_t<decltype(f(std::declval<const Deps&>()...))>> {
+        typedef std::decay_t<decltype(f(std::declval<const Deps&>()...))> R;
+        static_assert(!std::is_void<R>::value, "stages return a result");
+
+        auto result = std::make_shared<std::unique_ptr<R>>();
+        auto inputs = std::make_tuple(deps.result_...);
+        size_t index = shared_->nodes.size();
+
+        std::unique_ptr<Node> node(new Node);
+        node->name = std::move(name);
+        node->run = [f, result, inputs]() mutable {
+            result->reset(new R(
+                Apply(f, inputs, std::index_sequence_for<Deps...>())));
+        };
+        for (size_t dep : std::vector<size_t>{deps.index_...}) {
+            shared_->nodes[dep]->dependents.push_back(index);
+            node->depends_on.push_back(dep);
+        }
+        shared_->nodes.push_back(std::move(node));
+        return Stage<R>(index, std::move(result));
+    }
+
+    size_t size() const { return shared_->nodes.size(); }
+
+    // Runs the stages on this thread and on those `spawn` runs tasks on:
+    // each stage whose dependencies completed gets a task, which runs ready
+    // stages until there are none left. This thread does the same, so the
+    // dag completes even if the tasks are slow to start. Returns once no
+    // stage is running nor spawning tasks, so that `spawn` is not called
+    // after, having called `progress` with the number of stages done after
+    // each, and `changed` when one starts, is skipped or fails; under a
+    // lock, so that they never go backwards.
+    //
+    // Once `cancel` is set, the stages not started are skipped. A stage
+    // which throws fails, and those depending on it are skipped; the others
+    // still run, then Run() throws the first exception again. Called once.
+    void Run(std::function<void(std::function<void()>)> spawn,
+             const CancelToken& cancel,
+             std::function<void(size_t)> progress = nullptr,
+             std::function<void()> changed = nullptr) {
+        Shared& s = *shared_;
+        size_t ready;
+        {
+            std::lock_guard<std::mutex> lk(s.guard);
+            s.spawn = std::move(spawn);
+            s.cancel = &cancel;
+            s.progress = std::move(progress);
+            s.changed_state = std::move(changed);
+            s.remaining = s.nodes.size();
+            for (size_t i = 0; i < s.nodes.size(); ++i) {
+                s.nodes[i]->pending = s.nodes[i]->depends_on.size();
+                if (s.nodes[i]->pending == 0) {
+                    s.ready.push_back(i);
+                }
+            }
+            ready = s.ready.size();
+        }
+        // This thread takes one of the ready stages.
+        s.Spawn(ready - std::min<size_t>(ready, 1));
+
+        std::unique_lock<std::mutex> lk(s.guard);
+        while (s.remaining != 0 || s.spawning != 0) {
+            if (s.ready.empty()) {
+                s.changed.wait(lk);
+                continue;
+            }
+            size_t next = s.ready.front();
+            s.ready.pop_front();
+            lk.unlock();
+            s.Execute(next);
+            lk.lock();
+        }
+        // The stages hold the results they take and make: only the handles
+        // still around keep theirs.
+        for (auto& n : s.nodes) {
+            n->run = nullptr;
+        }
+        // Tasks still queued find nothing left to run: they may outlive the
+        // functions given, not call them.
+        s.spawn = nullptr;
+        s.cancel = nullptr;
+        s.progress = nullptr;
+        s.changed_state = nullptr;
+        std::exception_ptr error = s.error;
+        lk.unlock();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Consistent for each stage, not across stages.
+    std::vector<StageInfo> Stages() const {
+        std::lock_guard<std::mutex> lk(shared_->guard);
+        std::vector<StageInfo> stages;
+        for (auto& n : shared_->nodes) {
+            StageInfo info{n->name, {}, n->state, n->duration};
+            for (size_t dep : n->depends_on) {
+                info.depends_on.push_back(shared_->nodes[dep]->name);
+            }
+            stages.push_back(std::move(info));
+        }
+        return stages;
+    }
+
+   private:
+    struct Node {
+        std::string name;
+        std::function<void()> run;
+        std::vector<size_t> depends_on;
+        std::vector<size_t> dependents;
+        // Guarded by Shared::guard.
+        size_t pending = 0;
+        StageState state = StageState::kWaiting;
+        std::chrono::steady_clock::duration duration{0};
+    };
+
+    // With the tasks running stages, which can outlive the dag.
+    struct Shared : std::enable_shared_from_this<Shared> {
+        mutable std::mutex guard;
+        std::condition_variable changed;
+        std::vector<std::unique_ptr<Node>> nodes;
+        // Stages whose dependencies are done, not started yet.
+        std::deque<size_t> ready;
+        size_t remaining = 0;
+        size_t done = 0;
+        // The first exception a stage threw.
+        std::exception_ptr error;
+        // Stages done but still spawning tasks for their dependents: the
+        // last stage done can be one of them, so Run() waits for them too.
+        size_t spawning = 0;
+        // Set for the duration of Run(). Only used with stages left, or
+        // while spawning, so while it runs.
+        std::function<void(std::function<void()>)> spawn;
+        const CancelToken* cancel = nullptr;
+        std::function<void(size_t)> progress;
+        std::function<void()> changed_state;
+
+        void Spawn(size_t tasks) {
+            for (size_t i = 0; i < tasks; ++i) {
+                auto self = shared_from_this();
+                spawn([self]() { self->Drain(); });
+            }
+        }
+
+        // Runs a stage, then queues the stages it made ready, spawning tasks
+        // for all but one of them: that one is for this thread.
+        void Execute(size_t index) {
+            Node& node = *nodes[index];
+            bool skip = cancel->cancelled();
+            auto start = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lk(guard);
+                // Without the result of a dependency, there is nothing to
+                // run on.
+                for (size_t dep : node.depends_on) {
+                    skip = skip || nodes[dep]->state != StageState::kDone;
+                }
+                node.state = skip ? StageState::kSkipped : StageState::kRunning;
+                if (changed_state) {
+                    changed_state();
+                }
+            }
+            std::exception_ptr e;
+            if (!skip) {
+                try {
+                    node.run();
+                } catch (...) {
+                    e = std::current_exception();
+                }
+            }
+
+            size_t newly_ready = 0;
+            size_t tasks = 0;
+            {
+                std::lock_guard<std::mutex> lk(guard);
+                if (e) {
+                    node.state = StageState::kFailed;
+                    if (!error) {
+                        error = e;
+                    }
+                    if (changed_state) {
+                        changed_state();
+                    }
+                } else if (!skip) {
+                    node.state = StageState::kDone;
+                    node.duration = std::chrono::steady_clock::now() - start;
+                    ++done;
+                    if (progress) {
+                        progress(done);
+                    }
+                }
+                for (size_t d : node.dependents) {
+                    if (--nodes[d]->pending == 0) {
+                        ready.push_back(d);
+                        ++newly_ready;
+                    }
+                }
+                --remaining;
+                tasks = newly_ready - std::min<size_t>(newly_ready, 1);
+                if (tasks) {
+                    ++spawning;
+                }
+            }
+            changed.notify_all();
+            if (tasks) {
+                Spawn(tasks);
+                {
+                    std::lock_guard<std::mutex> lk(guard);
+                    --spawning;
+                }
+                changed.notify_all();
+            }
+        }
+
+        // Runs ready stages until there are none.
+        void Drain() {
+            std::unique_lock<std::mutex> lk(guard);
+            while (!ready.empty()) {
+                size_t next = ready.front();
+                ready.pop_front();
+                lk.unlock();
+                Execute(next);
+                lk.lock();
+            }
+        }
+    };
+
+    template <class F, class Inputs, size_t... I>
+    static auto Apply(F& f, const Inputs& inputs, std::index_sequence<I...>)
+        -> decltype(f(**std::get<I>(inputs)...)) {
+        return f(**std::get<I>(inputs)...);
+    }
+
+    std::shared_ptr<Shared> shared_;
+};
+
+}  // httpi
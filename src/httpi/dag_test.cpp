@@ -0,0 +1,194 @@
+#include "dag.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+
+int main() {
+    typedef httpi::Dag::StageState StageState;
+    httpi::Executor executor(4);
+    auto spawn = [&executor](std::function<void()> task) {
+        executor.Submit(std::move(task), httpi::Priority::kNormal);
+    };
+
+    // Typed results flow to the stages depending on them.
+    {
+        httpi::Dag dag;
+        auto text = dag.Add("text", []() { return std::string("a b\nc"); });
+        auto words = dag.Add(
+            "words",
+            [](const std::string& s) {
+                return 1 + std::count(s.begin(), s.end(), ' ') +
+                       std::count(s.begin(), s.end(), '\n');
+            },
+            text);
+        auto lines = dag.Add(
+            "lines",
+            [](const std::string& s) {
+                return size_t(1 + std::count(s.begin(), s.end(), '\n'));
+            },
+            text);
+        auto report = dag.Add(
+            "report",
+            [](long w, size_t l) {
+                return std::to_string(w) + " words, " + std::to_string(l) +
+                       " lines";
+            },
+            words,
+            lines);
+
+        httpi::CancelToken cancel;
+        std::vector<size_t> progress;
+        int started = 0;
+        dag.Run(spawn,
+                cancel,
+                [&progress](size_t done) { progress.push_back(done); },
+                [&started]() { ++started; });
+        assert(report.done());
+        assert(report.result() == "3 words, 2 lines");
+        assert((progress == std::vector<size_t>{1, 2, 3, 4}));
+        assert(started == 4);
+
+        auto stages = dag.Stages();
+        assert(stages.size() == 4);
+        assert(stages[3].name == "report");
+        assert((stages[3].depends_on ==
+                std::vector<std::string>{"words", "lines"}));
+        for (auto& s : stages) {
+            assert(s.state == StageState::kDone);
+        }
+    }
+
+    // Independent branches run at once.
+    {
+        httpi::Dag dag;
+        std::atomic<int> running{0}, most{0};
+        auto branch = [&running, &most]() {
+            int now = ++running;
+            int seen = most;
+            while (now > seen && !most.compare_exchange_weak(seen, now)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            --running;
+            return 1;
+        };
+        auto a = dag.Add("a", branch);
+        auto b = dag.Add("b", branch);
+        auto c = dag.Add("c", branch);
+        auto sum = dag.Add(
+            "sum", [](int x, int y, int z) { return x + y + z; }, a, b, c);
+        httpi::CancelToken cancel;
+        dag.Run(spawn, cancel);
+        assert(sum.result() == 3);
+        assert(most == 3);
+    }
+
+    // Without any other thread, the caller runs everything.
+    {
+        httpi::Dag dag;
+        auto a = dag.Add("a", []() { return 1; });
+        auto b = dag.Add("b", [](int x) { return x + 1; }, a);
+        auto c = dag.Add("c", [](int x) { return x + 1; }, a);
+        auto d = dag.Add("d", [](int x, int y) { return x * y; }, b, c);
+        httpi::CancelToken cancel;
+        std::vector<std::function<void()>> dropped;
+        dag.Run([&dropped](std::function<void()> t) { dropped.push_back(t); },
+                cancel);
+        assert(d.result() == 4);
+        // Tasks run late find nothing to do.
+        for (auto& t : dropped) {
+            t();
+        }
+    }
+
+    // Cancelling skips the stages not started.
+    {
+        httpi::Dag dag;
+        httpi::CancelToken cancel;
+        auto first = dag.Add("first", [&cancel]() {
+            cancel.Cancel();
+            return 1;
+        });
+        auto second = dag.Add("second", [](int x) { return x; }, first);
+        dag.Run(spawn, cancel);
+        assert(first.done() && !second.done());
+        assert(dag.Stages()[1].state == StageState::kSkipped);
+    }
+
+    // A stage throwing skips those depending on it, not the others, and Run()
+    // throws its exception again.
+    {
+        httpi::Dag dag;
+        auto bad = dag.Add("bad", []() -> int {
+            throw std::runtime_error("no input");
+        });
+        auto after = dag.Add("after", [](int x) { return x; }, bad);
+        auto other = dag.Add("other", []() { return 2; });
+        httpi::CancelToken cancel;
+        std::string error;
+        try {
+            dag.Run(spawn, cancel);
+        } catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+        assert(error == "no input");
+        assert(!bad.done() && !after.done() && other.done());
+        auto stages = dag.Stages();
+        assert(stages[0].state == StageState::kFailed);
+        assert(stages[1].state == StageState::kSkipped);
+        assert(stages[2].state == StageState::kDone);
+    }
+
+    // Results are freed once the dag ran, unless their handle is kept.
+    {
+        httpi::Dag dag;
+        std::weak_ptr<int> big;
+        auto sum = dag.Add(
+            "sum",
+            [](const std::shared_ptr<int>& p) { return *p + 1; },
+            dag.Add("big", [&big]() {
+                auto p = std::make_shared<int>(41);
+                big = p;
+                return p;
+            }));
+        httpi::CancelToken cancel;
+        dag.Run(spawn, cancel);
+        assert(sum.result() == 42);
+        assert(big.expired());
+    }
+
+    // The stage done last can still be spawning tasks for stages the other
+    // threads ran already: Run() waits for it before returning.
+    for (int i = 0; i < 200; ++i) {
+        httpi::Dag dag;
+        // This thread runs the first, a task the second, which makes the
+        // leaves ready.
+        dag.Add("first", []() { return 0; });
+        auto root = dag.Add("root", []() { return 1; });
+        for (int j = 0; j < 4; ++j) {
+            dag.Add("leaf", [](int x) { return x; }, root);
+        }
+        auto running = std::make_shared<std::atomic<bool>>(true);
+        httpi::CancelToken cancel;
+        dag.Run(
+            [&executor, running](std::function<void()> task) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                assert(*running);
+                executor.Submit(std::move(task), httpi::Priority::kNormal);
+            },
+            cancel);
+        *running = false;
+    }
+
+    std::cout << "OK\n";
+    return 0;
+}
@@ -1,33 +1,295 @@
 #include <signal.h>
+#include <strings.h>
 #include <sys/resource.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <future>
+#include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "displayer.h"
 #include "job.h"
 
+// Wakes a connection whose response waits for events, or whose upload waits
+// for room in its sink, from whichever thread makes progress. Shared with
+// the pullers, which may call it after the request is gone: it then does
+// nothing.
+struct StreamWaker {
+    std::mutex guard;
+    std::condition_variable woken_cv;
+    // Null once the request completed.
+    MHD_Connection* connection;
+    // False with a thread per connection, which cannot be suspended.
+    const bool suspend;
+    bool suspended = false;
+    // Woken while running rather than sleeping.
+    bool woken = false;
+    // The server is stopping: the connection is closed rather than
+    // suspended, which MHD does not allow on stopping.
+    bool stopped = false;
+
+    StreamWaker(MHD_Connection* c, bool s) : connection(c), suspend(s) {}
+
+    void Wake() {
+        std::lock_guard<std::mutex> lk(guard);
+        if (suspended) {
+            suspended = false;
+            MHD_resume_connection(connection);
+        } else {
+            woken = true;
+        }
+        woken_cv.notify_all();
+    }
+
+    // Called once the puller has nothing to send. Returns whether to pull
+    // again right away; if not, the connection was suspended until woken,
+    // unless Stopped().
+    bool Sleep() {
+        std::unique_lock<std::mutex> lk(guard);
+        if (!suspend) {
+            woken_cv.wait(lk, [this]() { return woken || stopped; });
+        }
+        if (stopped) {
+            return false;
+        }
+        if (woken) {
+            woken = false;
+            return true;
+        }
+        suspended = true;
+        MHD_suspend_connection(connection);
+        return false;
+    }
+
+    // Resumes the connection for good, for the server to stop.
+    void Stop() {
+        std::lock_guard<std::mutex> lk(guard);
+        stopped = true;
+        if (suspended) {
+            suspended = false;
+            MHD_resume_connection(connection);
+        }
+        woken_cv.notify_all();
+    }
+
+    bool Stopped() {
+        std::lock_guard<std::mutex> lk(guard);
+        return stopped;
+    }
+
+    void Detach() {
+        std::lock_guard<std::mutex> lk(guard);
+        connection = nullptr;
+        suspended = false;
+    }
+};
+
+// Walks the parts of a response as MHD asks for more bytes to send.
+struct ResponseCursor {
+    httpi::Response resp;
+    size_t part = 0;
+    // Position in the current buffer or in `chunk`.
+    size_t offset = 0;
+    // The last chunk given by the current producer, and whether it was the
+    // last one.
+    std::string chunk;
+    bool producer_done = false;
+    // Where to count the bytes sent, if anywhere.
+    httpi::RouteMetrics* metrics = nullptr;
+    // Set for responses with pulled parts, `wake` calling `waker`.
+    std::shared_ptr<StreamWaker> waker;
+    std::function<void()> wake;
+
+    void NextPart() {
+        ++part;
+        offset = 0;
+        chunk.clear();
+        producer_done = false;
+    }
+};
+
+// The state of one request. Recycled through ConnInfoPool: the arena keeps
+// its memory from one request to the next, so that a steady stream of
+// requests does not allocate for their headers and arguments. Up to 64 KB:
+// past that, as after a large form, an idle ConnInfo gives it back.
 struct ConnInfo {
+    HTTPServer* server;
+    MHD_Connection* connection;
     MHD_PostProcessor* post;
-    std::string page;
+    // Owns the buffers MHD is sending until the request completes.
+    ResponseCursor page;
+    httpi::Arena arena;
     POSTValues args;
 
-    ConnInfo() : post(nullptr) {}
+    // Set for requests to upload routes, whose body goes to the sink rather
+    // than to `args`, once admitted and opened.
+    bool upload_route = false;
+    bool upload_opened = false;
+    UploadSink upload;
+    // Set once the sink asked to wait for room.
+    std::shared_ptr<StreamWaker> upload_waker;
+    size_t max_body_size = 0;
+    size_t received = 0;
+    // Whether a response was queued, possibly before the body was read.
+    bool sent = false;
+
+    // Handshake with the Responder of an asynchronous handler, which may run
+    // on another thread.
+    std::mutex guard;
+    std::condition_variable answered;
+    bool executed = false;
+    bool ready = false;
+    bool suspended = false;
+    // Admission: whether the request went through it, whether it may run,
+    // and whether it holds a slot to give back.
+    bool entered = false;
+    bool admitted = false;
+    bool slot = false;
+    // When the request was complete and handed to its handler, or when its
+    // headers arrived for requests answered before their body.
+    std::chrono::steady_clock::time_point started;
+
+    ConnInfo()
+        : server(nullptr),
+          connection(nullptr),
+          post(nullptr),
+          args(POSTValues::allocator_type(
+              httpi::ArenaAllocator<POSTValues::value_type>(&arena))) {}
+
+    void Reset() {
+        MHD_destroy_post_processor(post);
+        post = nullptr;
+        page = ResponseCursor();
+        args.clear();
+        arena.Reset();
+        upload_route = false;
+        upload_opened = false;
+        upload = UploadSink();
+        upload_waker = nullptr;
+        received = 0;
+        sent = false;
+        executed = false;
+        ready = false;
+        suspended = false;
+        entered = false;
+        admitted = false;
+        slot = false;
+    }
 };
 
-static void request_completed(void* /* cls */,
+class ConnInfoPool {
+    // Past that many idle objects, finished requests free theirs.
+    static const size_t kMaxIdle = 256;
+
+    std::mutex guard_;
+    std::vector<std::unique_ptr<ConnInfo>> idle_;
+    // Those of the requests in progress.
+    std::unordered_set<ConnInfo*> live_;
+
+   public:
+    ConnInfoPool() { idle_.reserve(kMaxIdle); }
+
+    ConnInfo* Acquire() {
+        ConnInfo* info = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(guard_);
+            if (!idle_.empty()) {
+                info = idle_.back().release();
+                idle_.pop_back();
+            }
+        }
+        if (!info) {
+            info = new ConnInfo;
+        }
+        std::lock_guard<std::mutex> lk(guard_);
+        live_.insert(info);
+        return info;
+    }
+
+    void Release(ConnInfo* info) {
+        {
+            std::lock_guard<std::mutex> lk(guard_);
+            live_.erase(info);
+        }
+        info->Reset();
+        std::unique_ptr<ConnInfo> owned(info);
+        std::lock_guard<std::mutex> lk(guard_);
+        if (idle_.size() < kMaxIdle) {
+            idle_.push_back(std::move(owned));
+        }
+    }
+
+    // Calls `f` on the state of each request in progress, none of which
+    // completes meanwhile.
+    template <class F>
+    void ForEachLive(F f) {
+        std::lock_guard<std::mutex> lk(guard_);
+        for (ConnInfo* info : live_) {
+            f(info);
+        }
+    }
+};
+
+// Suspends the connection of `info` until it is admitted or answered, with
+// `info->guard` held. Returns false, leaving it as is, once the server is
+// stopping: the connection is then closed.
+static bool suspend(HTTPServer* srv, ConnInfo* info) {
+    if (srv->stopping()) {
+        return false;
+    }
+    info->suspended = true;
+    MHD_suspend_connection(info->connection);
+    return true;
+}
+
+static void request_completed(void* cls,
                               struct MHD_Connection* /* connection */,
                               void** con_cls,
                               enum MHD_RequestTerminationCode /* toe */) {
+    HTTPServer* srv = static_cast<HTTPServer*>(cls);
     ConnInfo* info = static_cast<ConnInfo*>(*con_cls);
-    MHD_destroy_post_processor(info->post);
-    delete info;
+    if (info) {
+        if (info->upload.write && !info->executed && info->upload.abort) {
+            info->upload.abort();
+        }
+        if (info->page.waker) {
+            info->page.waker->Detach();
+        }
+        if (info->upload_waker) {
+            info->upload_waker->Detach();
+        }
+        // Gone while waiting for a slot, or before using the one it got.
+        if (info->entered && !info->executed &&
+            !srv->admission().Cancel(info) && info->slot) {
+            srv->admission().Leave();
+        }
+        srv->conn_pool().Release(info);
+        *con_cls = nullptr;
+    }
+}
+
+// Returns args[key], without building a string for `key` when it is there.
+static httpi::ArenaStringValue& arg_slot(POSTValues& args, const char* key) {
+    auto found = args.find(key);
+    if (found != args.end()) {
+        return found->second;
+    }
+    return args
+        .emplace(std::piecewise_construct,
+                 std::forward_as_tuple(key),
+                 std::forward_as_tuple())
+        .first->second;
 }
 
 static int iterate_post(void* coninfo_cls,
@@ -42,22 +304,436 @@ static int iterate_post(void* coninfo_cls,
     POSTValues& args = *static_cast<POSTValues*>(coninfo_cls);
 
     if (size > 0) {
-        std::string& value = args[key];
-        value.append(data, size);
+        arg_slot(args, key).append(data, size);
     }
 
     return MHD_YES;
 }
 
-std::string HTTPServer::Execute(const std::string& url,
-                                const std::string& method,
-                                const POSTValues& pv) {
-    std::unique_lock<std::mutex> lk(cb_mutex_);
-    auto res = callbacks_.find(url);
-    if (res != callbacks_.end()) {
-        return res->second(method, pv);
+static int stream_post(void* cls,
+                       enum MHD_ValueKind,
+                       const char* key,
+                       const char* filename,
+                       const char* /* content_type */,
+                       const char* /* transfer_encoding */,
+                       const char* data,
+                       uint64_t /* off */,
+                       size_t size) {
+    UploadSink& sink = *static_cast<UploadSink*>(cls);
+    if (size == 0) {
+        return MHD_YES;
+    }
+    return sink.write(key, filename, data, size) ? MHD_YES : MHD_NO;
+}
+
+static int collect_value(void* cls,
+                         enum MHD_ValueKind,
+                         const char* key,
+                         const char* value) {
+    POSTValues& args = *static_cast<POSTValues*>(cls);
+    arg_slot(args, key).assign(value ? value : "");
+    return MHD_YES;
+}
+
+// Feeds a multi-part response to MHD. This is the only copy of the body,
+// straight into the connection's send buffer.
+static ssize_t read_response(void* cls,
+                             uint64_t /* pos */,
+                             char* buf,
+                             size_t max) {
+    ResponseCursor& cur = *static_cast<ResponseCursor*>(cls);
+    const auto& body = cur.resp.body();
+
+    size_t written = 0;
+    size_t produced = 0;
+    while (written < max && cur.part < body.size()) {
+        const httpi::Response::Part& p = body[cur.part];
+        const std::string* src = p.buffer.get();
+        if (!src) {
+            if (cur.offset == cur.chunk.size() && !cur.producer_done) {
+                cur.chunk.clear();
+                cur.offset = 0;
+                if (p.producer) {
+                    cur.producer_done = !p.producer(&cur.chunk);
+                } else {
+                    auto pulled = p.puller(&cur.chunk, cur.wake);
+                    if (pulled == httpi::Response::Pulled::kWait) {
+                        // Send what is there first, and only then sleep.
+                        if (written > 0 || !cur.waker->Sleep()) {
+                            if (written == 0 && cur.waker->Stopped()) {
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                            }
+                            break;
+                        }
+                        continue;
+                    }
+                    cur.producer_done = pulled == httpi::Response::Pulled::kEnd;
+                }
+            }
+            src = &cur.chunk;
+        }
+
+        size_t len = std::min(src->size() - cur.offset, max - written);
+        std::memcpy(buf + written, src->data() + cur.offset, len);
+        written += len;
+        cur.offset += len;
+        if (!p.buffer) {
+            produced += len;
+        }
+
+        if (cur.offset == src->size() && (p.buffer || cur.producer_done)) {
+            cur.NextPart();
+        }
+    }
+
+    // Buffered parts were counted when the response was queued.
+    if (produced && cur.metrics) {
+        cur.metrics->AddBytes(produced);
+    }
+    if (written == 0 && cur.part == body.size()) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    return written;
+}
+
+// FNV-1a over the body, quoted as an ETag. Written in base 64 to fit in the
+// small string buffer, so that tagging a response does not allocate.
+static std::string body_etag(const httpi::Response& resp) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    uint64_t h = 14695981039346656037ull;
+    for (auto& p : resp.body()) {
+        for (char c : *p.buffer) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+    }
+    char etag[14] = {'"'};
+    for (int i = 1; i <= 11; ++i, h >>= 6) {
+        etag[i] = digits[h & 63];
+    }
+    etag[12] = '"';
+    return std::string(etag, 13);
+}
+
+// Whether an If-None-Match header lists `etag`. Weak comparison, as the RFC
+// asks for this header.
+static bool etag_matches(const char* if_none_match, const std::string& etag) {
+    const char* s = if_none_match;
+    while (*s) {
+        while (*s == ' ' || *s == ',') {
+            ++s;
+        }
+        if (*s == '*') {
+            return true;
+        }
+        if (s[0] == 'W' && s[1] == '/') {
+            s += 2;
+        }
+        const char* end = s;
+        while (*end && *end != ',') {
+            ++end;
+        }
+        const char* last = end;
+        while (last > s && last[-1] == ' ') {
+            --last;
+        }
+        if (etag.compare(0, etag.size(), s, last - s) == 0) {
+            return true;
+        }
+        s = end;
+    }
+    return false;
+}
+
+static MHD_Response* make_mhd_response(ResponseCursor& cur) {
+    const httpi::Response& resp = cur.resp;
+    MHD_Response* response;
+    if (resp.body().size() == 1 && !resp.streamed()) {
+        const std::string& body = *resp.body().front().buffer;
+        response = MHD_create_response_from_buffer(
+            body.size(), (void*)body.data(), MHD_RESPMEM_PERSISTENT);
+    } else if (resp.body().empty()) {
+        response =
+            MHD_create_response_from_buffer(0, nullptr, MHD_RESPMEM_PERSISTENT);
+    } else {
+        response = MHD_create_response_from_callback(
+            resp.streamed() ? MHD_SIZE_UNKNOWN : resp.size(),
+            32 * 1024,
+            &read_response,
+            &cur,
+            nullptr);
+    }
+
+    for (auto& h : resp.headers()) {
+        MHD_add_response_header(response, h.first.c_str(), h.second.c_str());
+    }
+    if (!resp.etag().empty()) {
+        MHD_add_response_header(
+            response, MHD_HTTP_HEADER_ETAG, resp.etag().c_str());
+        // Revalidate on every load rather than showing a stale dashboard.
+        MHD_add_response_header(
+            response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    }
+    return response;
+}
+
+void HTTPServer::Execute(const std::string& url,
+                         const std::string& method,
+                         const POSTValues& pv,
+                         Responder done) {
+    Execute(url, method, pv, std::move(done), nullptr);
+}
+
+void HTTPServer::Execute(const std::string& url,
+                         const std::string& method,
+                         const POSTValues& pv,
+                         Responder done,
+                         httpi::RouteMetrics** route) {
+    auto callbacks = callbacks_.Load();
+    httpi::PathParams params;
+    auto res = callbacks->Find(url, &params);
+    if (route) {
+        *route = res ? res->value.metrics : unmatched_;
+    }
+    if (!res) {
+        done(httpi::Response(error404_).Status(MHD_HTTP_NOT_FOUND));
+    } else if (res->value.handler) {
+        done(res->value.handler(method, pv, params));
+    } else if (res->value.async_handler) {
+        res->value.async_handler(method, pv, params, std::move(done));
+    } else {
+        // Called directly rather than for a request: an empty upload.
+        UploadSink sink = res->value.upload_handler(method, pv, params);
+        done(sink.finish ? sink.finish()
+                         : httpi::Response().Status(MHD_HTTP_BAD_REQUEST));
+    }
+}
+
+bool HTTPServer::FindUpload(const std::string& url,
+                            size_t* max_body_size,
+                            httpi::RouteMetrics** route) {
+    auto callbacks = callbacks_.Load();
+    httpi::PathParams params;
+    auto res = callbacks->Find(url, &params);
+    *max_body_size = res && res->value.max_body_size ? res->value.max_body_size
+                                                     : config_.max_body_size;
+    *route = res ? res->value.metrics : unmatched_;
+    return res && res->value.upload_handler;
+}
+
+bool HTTPServer::OpenUpload(const std::string& url,
+                            const std::string& method,
+                            const POSTValues& headers,
+                            UploadSink* sink) {
+    auto callbacks = callbacks_.Load();
+    httpi::PathParams params;
+    auto res = callbacks->Find(url, &params);
+    if (!res || !res->value.upload_handler) {
+        return false;
+    }
+    *sink = res->value.upload_handler(method, headers, params);
+    return true;
+}
+
+httpi::Response HTTPServer::Execute(const std::string& url,
+                                    const std::string& method,
+                                    const POSTValues& pv) {
+    std::promise<httpi::Response> answer;
+    auto future = answer.get_future();
+    Execute(url, method, pv, [&answer](httpi::Response resp) {
+        answer.set_value(std::move(resp));
+    });
+    return future.get();
+}
+
+// Turns the handler's response into what is actually sent: a 304 if the
+// client already has this version, a compressed body if it accepts one.
+static void prepare_response(HTTPServer& srv,
+                             MHD_Connection* connection,
+                             const std::string& url,
+                             const std::string& method,
+                             httpi::Response* resp) {
+    const ServerConfig& config = srv.config();
+    if (resp->status() != MHD_HTTP_OK) {
+        return;
+    }
+
+    bool conditional = method == "GET" || method == "HEAD";
+    if (conditional && resp->etag().empty() && config.etags &&
+        !resp->streamed()) {
+        resp->ETag(body_etag(*resp));
+    }
+
+    bool compressible = config.compression && !resp->streamed() &&
+                        resp->size() >= config.compression_min_size;
+    for (auto& h : resp->headers()) {
+        if (strcasecmp(h.first.c_str(), MHD_HTTP_HEADER_CONTENT_ENCODING) ==
+            0) {
+            compressible = false;
+        }
+    }
+
+    httpi::ContentEncoding enc = httpi::ContentEncoding::kIdentity;
+    if (compressible) {
+        enc = httpi::NegotiateEncoding(MHD_lookup_connection_value(
+            connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING));
+    }
+
+    // Each encoding is a representation of its own, with its own ETag.
+    std::string etag = resp->etag();
+    if (enc != httpi::ContentEncoding::kIdentity && !etag.empty()) {
+        etag.insert(etag.size() - 1, std::string("-") + EncodingName(enc));
+    }
+
+    const char* if_none_match = MHD_lookup_connection_value(
+        connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+    if (conditional && !etag.empty() && if_none_match &&
+        etag_matches(if_none_match, etag)) {
+        *resp = httpi::Response();
+        resp->Status(MHD_HTTP_NOT_MODIFIED).ETag(std::move(etag));
+    } else if (enc != httpi::ContentEncoding::kIdentity) {
+        auto compressed = srv.compression_cache().Get(
+            url, *resp, enc, config.compression_level);
+        if (compressed) {
+            httpi::Response encoded(std::move(compressed));
+            for (auto& h : resp->headers()) {
+                encoded.Header(h.first, h.second);
+            }
+            encoded.Header(MHD_HTTP_HEADER_CONTENT_ENCODING,
+                           EncodingName(enc));
+            encoded.ETag(std::move(etag));
+            *resp = std::move(encoded);
+        }
+    }
+
+    if (compressible) {
+        resp->Header(MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    }
+}
+
+// Hands the response of `info` over to the connection, from any thread, and
+// frees its slot for the next request.
+static void answer(ConnInfo* info, httpi::Response resp) {
+    bool slot;
+    {
+        std::lock_guard<std::mutex> lk(info->guard);
+        info->page.resp = std::move(resp);
+        info->ready = true;
+        slot = info->slot;
+        info->slot = false;
+        if (info->suspended) {
+            info->suspended = false;
+            MHD_resume_connection(info->connection);
+        }
+        info->answered.notify_all();
+    }
+    if (slot) {
+        info->server->admission().Leave();
+    }
+}
+
+// Asks for a slot for `info`. If it has to wait, the connection is resumed
+// once it gets one; if it is turned away, it is answered with a 503.
+static void admit(HTTPServer* srv, ConnInfo* info) {
+    auto decision = srv->admission().Enter(info, [info]() {
+        std::lock_guard<std::mutex> lk(info->guard);
+        info->admitted = true;
+        info->slot = true;
+        if (info->suspended) {
+            info->suspended = false;
+            MHD_resume_connection(info->connection);
+        }
+        info->answered.notify_all();
+    });
+
+    switch (decision) {
+        case httpi::Admission::Decision::kRun: {
+            std::lock_guard<std::mutex> lk(info->guard);
+            info->admitted = true;
+            info->slot = true;
+            break;
+        }
+        case httpi::Admission::Decision::kQueued:
+            break;
+        case httpi::Admission::Decision::kRejected:
+            if (info->upload.abort) {
+                info->upload.abort();
+            }
+            info->executed = true;
+            answer(info,
+                   httpi::Response(
+                       "<html><head><title>Overloaded</title></head><body>"
+                       "Too many requests, try again later.</body></html>")
+                       .Status(MHD_HTTP_SERVICE_UNAVAILABLE)
+                       .Header(MHD_HTTP_HEADER_RETRY_AFTER,
+                               std::to_string(srv->config().retry_after)));
+            break;
     }
-    return error404_;
+}
+
+// Sends the response of `info`, for good.
+static int send_response(HTTPServer& srv,
+                         MHD_Connection* connection,
+                         const std::string& url,
+                         const std::string& method,
+                         ConnInfo* info) {
+    prepare_response(srv, connection, url, method, &info->page.resp);
+
+    const httpi::Response& resp = info->page.resp;
+    auto latency = std::chrono::steady_clock::now() - info->started;
+    info->page.metrics->Record(
+        resp.status(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(),
+        resp.size());
+
+    if (resp.pulled()) {
+        auto waker = std::make_shared<StreamWaker>(
+            connection, !srv.config().thread_per_connection);
+        {
+            // Read by the server stopping.
+            std::lock_guard<std::mutex> lk(info->guard);
+            info->page.waker = waker;
+        }
+        if (srv.stopping()) {
+            waker->Stop();
+        }
+        info->page.wake = [waker]() { waker->Wake(); };
+    }
+
+    struct MHD_Response* response = make_mhd_response(info->page);
+    int ret = MHD_queue_response(connection, resp.status(), response);
+    info->sent = true;
+
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Opens the sink of an admitted upload. A sink which does not take the body
+// answers right away, and the body is dropped.
+static void open_upload(HTTPServer* srv,
+                        ConnInfo* info,
+                        const char* url,
+                        const std::string& method) {
+    info->upload_opened = true;
+    if (srv->OpenUpload(url, method, info->args, &info->upload) &&
+        info->upload.write) {
+        // Uploads get larger pieces, and fewer calls to their sink.
+        info->post = MHD_create_post_processor(
+            info->connection, 32 * 1024, stream_post, &info->upload);
+        return;
+    }
+    info->executed = true;
+    answer(info,
+           info->upload.finish
+               ? info->upload.finish()
+               : httpi::Response().Status(MHD_HTTP_BAD_REQUEST));
+}
+
+static httpi::Response too_large() {
+    return httpi::Response(
+               "<html><head><title>Payload too large</title></head><body>"
+               "Payload too large.</body></html>")
+        .Status(MHD_HTTP_REQUEST_ENTITY_TOO_LARGE);
 }
 
 static int answer_to_connection(void* cls,
@@ -72,65 +748,406 @@ static int answer_to_connection(void* cls,
     ConnInfo* info = static_cast<ConnInfo*>(*con_cls);
     std::string method = m;
     if (*con_cls == nullptr) {
-        *con_cls = new ConnInfo;
-        info = static_cast<ConnInfo*>(*con_cls);
-        info->post = MHD_create_post_processor(
-            connection, 512, iterate_post, &info->args);
+        info = srv->conn_pool().Acquire();
+        *con_cls = info;
+        info->server = srv;
+        info->connection = connection;
+        info->started = std::chrono::steady_clock::now();
+
+        // Only the headers are in: decide what to do with the body.
+        MHD_get_connection_values(
+            connection,
+            static_cast<MHD_ValueKind>(MHD_HEADER_KIND | MHD_GET_ARGUMENT_KIND),
+            collect_value,
+            &info->args);
+        info->upload_route = srv->FindUpload(
+            url, &info->max_body_size, &info->page.metrics);
+
+        const char* length = MHD_lookup_connection_value(
+            connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+        if (length && std::strtoull(length, nullptr, 10) > info->max_body_size) {
+            info->page.resp = too_large();
+            return send_response(*srv, connection, url, method, info);
+        }
+
+        if (!info->upload_route) {
+            info->post = MHD_create_post_processor(
+                connection, 512, iterate_post, &info->args);
+            return MHD_YES;
+        }
+
+        // Opening the sink may start work, like a job consuming the body:
+        // uploads are admitted first, and hold their slot while the body
+        // streams in. Queued ones are opened once admitted.
+        info->entered = true;
+        admit(srv, info);
+        if (info->admitted) {
+            open_upload(srv, info, url, method);
+        }
+        if (info->ready) {
+            // Turned away, or refused by the sink.
+            return send_response(*srv, connection, url, method, info);
+        }
+        return MHD_YES;
+    }
+
+    if (info->sent) {
+        // Answered before the body was read: drop it.
+        *upload_data_size = 0;
         return MHD_YES;
     }
 
+    if (*upload_data_size != 0 && info->upload_route && !info->upload_opened) {
+        std::unique_lock<std::mutex> lk(info->guard);
+        if (!info->admitted) {
+            // Queued: the data is left unread until there is a slot.
+            if (srv->config().thread_per_connection) {
+                info->answered.wait(lk, [srv, info]() {
+                    return info->admitted || srv->stopping();
+                });
+                if (!info->admitted) {
+                    return MHD_NO;
+                }
+            } else {
+                return suspend(srv, info) ? MHD_YES : MHD_NO;
+            }
+        }
+        lk.unlock();
+        open_upload(srv, info, url, method);
+    }
+
+    if (*upload_data_size != 0 && info->upload_opened && !info->upload.write) {
+        // Refused by the sink, which answered: drop the body.
+        *upload_data_size = 0;
+        return MHD_YES;
+    }
+
+    if (*upload_data_size != 0 && info->upload.ready) {
+        if (!info->upload_waker) {
+            auto waker = std::make_shared<StreamWaker>(
+                connection, !srv->config().thread_per_connection);
+            {
+                // Read by the server stopping.
+                std::lock_guard<std::mutex> lk(info->guard);
+                info->upload_waker = waker;
+            }
+            if (srv->stopping()) {
+                waker->Stop();
+            }
+        }
+        auto waker = info->upload_waker;
+        while (!info->upload.ready(*upload_data_size,
+                                   [waker]() { waker->Wake(); })) {
+            if (!waker->Sleep()) {
+                // Suspended, the data left unread: MHD hands it again once
+                // the sink has room.
+                return waker->Stopped() ? MHD_NO : MHD_YES;
+            }
+        }
+    }
+
     if (*upload_data_size != 0) {
-        MHD_post_process(info->post, upload_data, *upload_data_size);
+        info->received += *upload_data_size;
+        if (info->received > info->max_body_size) {
+            // Too late to answer: MHD closes the connection.
+            info->page.metrics->Record(
+                MHD_HTTP_REQUEST_ENTITY_TOO_LARGE, 0, 0);
+            return MHD_NO;
+        }
+        if (info->upload.write) {
+            bool ok = info->post ? MHD_post_process(info->post,
+                                                    upload_data,
+                                                    *upload_data_size) == MHD_YES
+                                 : info->upload.write("",
+                                                      nullptr,
+                                                      upload_data,
+                                                      *upload_data_size);
+            if (!ok) {
+                return MHD_NO;
+            }
+        } else {
+            MHD_post_process(info->post, upload_data, *upload_data_size);
+        }
         *upload_data_size = 0;
         return MHD_YES;
     }
 
-    MHD_get_connection_values(
-        connection,
-        static_cast<MHD_ValueKind>(MHD_POSTDATA_KIND | MHD_GET_ARGUMENT_KIND |
-                                   MHD_RESPONSE_HEADER_KIND | MHD_HEADER_KIND),
-        [](void* cls, MHD_ValueKind, const char* k, const char* v) {
-            POSTValues& post = *static_cast<POSTValues*>(cls);
-            post[k] = v;
-            return MHD_YES;
-        },
-        &info->args);
+    std::unique_lock<std::mutex> lk(info->guard);
+    if (!info->entered) {
+        info->entered = true;
+        lk.unlock();
+        if (url == srv->config().metrics_url) {
+            info->admitted = true;
+        } else {
+            admit(srv, info);
+        }
+        lk.lock();
+    }
 
-    info->page = srv->Execute(url, method, info->args);
-    struct MHD_Response* response = MHD_create_response_from_buffer(
-        info->page.size(), (void*)info->page.c_str(), MHD_RESPMEM_PERSISTENT);
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    if (!info->admitted && !info->ready) {
+        // Queued: wait for a slot.
+        if (srv->config().thread_per_connection) {
+            info->answered.wait(lk, [srv, info]() {
+                return info->admitted || info->ready || srv->stopping();
+            });
+            if (!info->admitted && !info->ready) {
+                return MHD_NO;
+            }
+        } else {
+            return suspend(srv, info) ? MHD_YES : MHD_NO;
+        }
+    }
 
-    MHD_destroy_response(response);
-    return ret;
+    if (info->upload_route && !info->upload_opened && info->admitted) {
+        // An empty body, admitted after it was complete.
+        lk.unlock();
+        open_upload(srv, info, url, method);
+        lk.lock();
+    }
+
+    if (!info->executed && info->admitted) {
+        info->executed = true;
+        lk.unlock();
+
+        MHD_get_connection_values(
+            connection,
+            static_cast<MHD_ValueKind>(MHD_POSTDATA_KIND |
+                                       MHD_GET_ARGUMENT_KIND |
+                                       MHD_RESPONSE_HEADER_KIND |
+                                       MHD_HEADER_KIND),
+            collect_value,
+            &info->args);
+
+        info->started = std::chrono::steady_clock::now();
+        if (info->upload.write) {
+            answer(info, info->upload.finish());
+        } else {
+            srv->Execute(url,
+                         method,
+                         info->args,
+                         [info](httpi::Response resp) {
+                             answer(info, std::move(resp));
+                         },
+                         &info->page.metrics);
+        }
+        lk.lock();
+        // An asynchronous handler which returned without answering waits
+        // for something else, like a job: it holds no slot meanwhile, or a
+        // few long waits would turn every other request away.
+        if (!info->ready && info->slot) {
+            info->slot = false;
+            lk.unlock();
+            srv->admission().Leave();
+            lk.lock();
+        }
+    }
+
+    if (!info->ready) {
+        // MHD cannot suspend a connection that has its own thread, and
+        // blocking that thread costs nothing to the others.
+        if (srv->config().thread_per_connection) {
+            info->answered.wait(
+                lk, [srv, info]() { return info->ready || srv->stopping(); });
+            if (!info->ready) {
+                return MHD_NO;
+            }
+        } else {
+            return suspend(srv, info) ? MHD_YES : MHD_NO;
+        }
+    }
+    lk.unlock();
+
+    return send_response(*srv, connection, url, method, info);
+}
+
+bool HTTPServer::RegisterUrl(const std::string& str, UrlHandler f) {
+    return RegisterUrl(
+        str,
+        [f](const std::string& method,
+            const POSTValues& pv,
+            const httpi::PathParams&) { return f(method, pv); });
 }
 
-void HTTPServer::RegisterUrl(const std::string& str, UrlHandler f) {
-    std::unique_lock<std::mutex> lk(cb_mutex_);
-    callbacks_.insert(std::make_pair(str, std::move(f)));
+bool HTTPServer::RegisterUrl(const std::string& str, RoutedUrlHandler f) {
+    Route route;
+    route.handler = std::move(f);
+    return AddRoute(str, std::move(route));
 }
 
-HTTPServer::~HTTPServer() { MHD_stop_daemon(daemon_); }
+bool HTTPServer::RegisterAsyncUrl(const std::string& str, AsyncUrlHandler f) {
+    Route route;
+    route.async_handler = std::move(f);
+    return AddRoute(str, std::move(route));
+}
+
+bool HTTPServer::RegisterUploadUrl(const std::string& str,
+                                   UploadUrlHandler f,
+                                   size_t max_body_size) {
+    Route route;
+    route.upload_handler = std::move(f);
+    route.max_body_size = max_body_size;
+    return AddRoute(str, std::move(route));
+}
+
+// A rejected route leaves the table as it was, and gets no metrics.
+bool HTTPServer::AddRoute(const std::string& str, Route route) {
+    bool inserted = false;
+    callbacks_.Update([&](const std::shared_ptr<const RouteTable>& cur) {
+        if (!cur->CanInsert(str)) {
+            return cur;
+        }
+        route.metrics = metrics_.ForRoute(str);
+        auto next = std::make_shared<RouteTable>(*cur);
+        inserted = next->Insert(str, std::move(route));
+        return std::shared_ptr<const RouteTable>(std::move(next));
+    });
+    return inserted;
+}
+
+bool HTTPServer::UnregisterUrl(const std::string& str) {
+    bool found = false;
+    callbacks_.Update([&](const std::shared_ptr<const RouteTable>& cur) {
+        auto next = std::make_shared<RouteTable>(*cur);
+        found = next->Erase(str);
+        return found ? std::shared_ptr<const RouteTable>(std::move(next))
+                     : cur;
+    });
+    return found;
+}
+
+HTTPServer::~HTTPServer() {
+    if (daemon_) {
+        // MHD refuses to stop with suspended connections, like those waiting
+        // for events or for a job: they are resumed, and closed instead of
+        // being suspended again.
+        stopping_ = true;
+        conn_pool_->ForEachLive([](ConnInfo* info) {
+            std::shared_ptr<StreamWaker> wakers[2];
+            {
+                std::lock_guard<std::mutex> lk(info->guard);
+                if (info->suspended) {
+                    info->suspended = false;
+                    MHD_resume_connection(info->connection);
+                }
+                info->answered.notify_all();
+                wakers[0] = info->page.waker;
+                wakers[1] = info->upload_waker;
+            }
+            for (auto& w : wakers) {
+                if (w) {
+                    w->Stop();
+                }
+            }
+        });
+        MHD_stop_daemon(daemon_);
+    }
+}
 
 void HTTPServer::ServiceLoopForever() {
     std::unique_lock<std::mutex> lk(stop_mutex_);
     stop_signal_.wait(lk, [&]() { return !running_; });
 }
 
-HTTPServer::HTTPServer(int port)
-    : error404_(
+HTTPServer::HTTPServer(int port, const ServerConfig& config)
+    : config_(config),
+      callbacks_(std::make_shared<RouteTable>()),
+      compression_cache_(config.compression_cache_bytes),
+      unmatched_(metrics_.ForRoute("")),
+      admission_(config.max_in_flight, config.max_queued),
+      conn_pool_(new ConnInfoPool),
+      error404_(std::make_shared<const std::string>(
           "<html><head><title>Not found</title></head><body>Go "
-          "away.</body></html>") {
-    daemon_ = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY,
-                               port,
-                               nullptr,
-                               nullptr,
-                               &answer_to_connection,
-                               this,
-                               MHD_OPTION_NOTIFY_COMPLETED,
-                               request_completed,
-                               nullptr,
-                               MHD_OPTION_END);
+          "away.</body></html>")) {
+    unsigned int flags = 0;
+    switch (config_.event_loop) {
+        case ServerConfig::EventLoop::kSelect:
+            break;
+        case ServerConfig::EventLoop::kPoll:
+            flags |= MHD_USE_POLL;
+            break;
+        case ServerConfig::EventLoop::kEpoll:
+            flags |= MHD_USE_EPOLL_LINUX_ONLY;
+            break;
+    }
+
+    std::vector<MHD_OptionItem> options;
+    if (config_.thread_per_connection) {
+        flags |= MHD_USE_THREAD_PER_CONNECTION;
+    } else {
+        flags |= MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME;
+        if (config_.thread_pool_size > 1) {
+            options.push_back({MHD_OPTION_THREAD_POOL_SIZE,
+                               config_.thread_pool_size,
+                               nullptr});
+        }
+    }
+    if (config_.max_connections) {
+        options.push_back(
+            {MHD_OPTION_CONNECTION_LIMIT, config_.max_connections, nullptr});
+    }
+    if (config_.max_connections_per_ip) {
+        options.push_back({MHD_OPTION_PER_IP_CONNECTION_LIMIT,
+                           config_.max_connections_per_ip,
+                           nullptr});
+    }
+    if (config_.connection_timeout) {
+        options.push_back({MHD_OPTION_CONNECTION_TIMEOUT,
+                           config_.connection_timeout,
+                           nullptr});
+    }
+    if (config_.connection_memory_limit) {
+        options.push_back({MHD_OPTION_CONNECTION_MEMORY_LIMIT,
+                           static_cast<intptr_t>(
+                               config_.connection_memory_limit),
+                           nullptr});
+    }
+    options.push_back({MHD_OPTION_END, 0, nullptr});
+
+    // MHD has no thread per connection with epoll, and ignores the pool
+    // size with threads per connection: the server is not started rather
+    // than run with another setup than asked for.
+    if (config_.thread_per_connection &&
+        (config_.event_loop == ServerConfig::EventLoop::kEpoll ||
+         config_.thread_pool_size > 1)) {
+        std::cerr << "httpi: thread_per_connection takes neither kEpoll nor "
+                     "a thread pool\n";
+        daemon_ = nullptr;
+    } else {
+        daemon_ = MHD_start_daemon(flags,
+                                   port,
+                                   nullptr,
+                                   nullptr,
+                                   &answer_to_connection,
+                                   this,
+                                   MHD_OPTION_NOTIFY_COMPLETED,
+                                   request_completed,
+                                   this,
+                                   MHD_OPTION_ARRAY,
+                                   options.data(),
+                                   MHD_OPTION_END);
+    }
 
     running_ = (nullptr != daemon_);
+
+    if (!config_.metrics_url.empty()) {
+        RegisterUrl(config_.metrics_url,
+                    [this](const std::string&, const POSTValues&) {
+                        std::string text;
+                        metrics_.WritePrometheus(&text);
+                        admission_.WritePrometheus(&text);
+                        text +=
+                            "# TYPE httpi_compression_cache_hits_total "
+                            "counter\n"
+                            "httpi_compression_cache_hits_total " +
+                            std::to_string(compression_cache_.hits()) +
+                            "\n# TYPE httpi_compression_cache_misses_total "
+                            "counter\n"
+                            "httpi_compression_cache_misses_total " +
+                            std::to_string(compression_cache_.misses()) + "\n";
+                        httpi::Response resp(std::move(text));
+                        resp.Header(MHD_HTTP_HEADER_CONTENT_TYPE,
+                                    "text/plain; version=0.0.4");
+                        return resp;
+                    });
+    }
 }
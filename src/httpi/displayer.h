@@ -3,39 +3,259 @@
 #include <microhttpd.h>
 #include <algorithm>
 #include <boost/circular_buffer.hpp>
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 
-typedef std::map<std::string, std::string> POSTValues;
-typedef std::function<std::string(const std::string&, const POSTValues&)>
+#include "admission.h"
+#include "arena.h"
+#include "compression.h"
+#include "metrics.h"
+#include "response.h"
+#include "router.h"
+#include "snapshot.h"
+
+// Request headers, query arguments and form fields, by name. Strings and nodes
+// live in the arena of the request. Values convert to std::string, and
+// compare with them, as when this was a map of std::string; the converted
+// copies, like a copy of the whole map, are on the heap and can be kept after
+// the request, references into the map cannot.
+typedef httpi::ArenaStringMap POSTValues;
+typedef std::function<httpi::Response(const std::string&, const POSTValues&)>
     UrlHandler;
+// For routes with `:param` or `*wildcard` segments, see httpi::Router.
+typedef std::function<httpi::Response(
+    const std::string&, const POSTValues&, const httpi::PathParams&)>
+    RoutedUrlHandler;
+
+// Completes an asynchronous request. Must be called exactly once, from any
+// thread.
+typedef std::function<void(httpi::Response)> Responder;
+// A handler that does not answer right away, for instance because it waits for
+// a job. The connection is suspended until `done` is called and holds no
+// thread meanwhile.
+typedef std::function<void(const std::string&,
+                           const POSTValues&,
+                           const httpi::PathParams&,
+                           Responder done)>
+    AsyncUrlHandler;
+
+// Where the body of an upload goes as it arrives, see
+// HTTPServer::RegisterUploadUrl.
+struct UploadSink {
+    // Called with each piece of the body, in order, on the server thread
+    // reading it, which serves other connections too: it should not block.
+    // For form bodies, `field` and `filename` tell which field the piece
+    // belongs to; for any other body, `field` is empty and `filename` null.
+    // Returning false aborts the request.
+    std::function<bool(const char* field,
+                       const char* filename,
+                       const char* data,
+                       size_t size)>
+        write;
+    // Called once the whole body has been written, to answer. A sink without
+    // `write` answers with `finish` before the body is read, for instance to
+    // refuse the upload.
+    std::function<httpi::Response()> finish;
+    // Called instead of `finish` when the body does not make it: the client
+    // went away, the body went past the size limit or `write` failed.
+    std::function<void()> abort;
+    // Optional flow control, asked before each piece of the body is read:
+    // whether `size` more bytes can be written now. If not, nothing more is
+    // read from the client until `wake` is called, from any thread, so a
+    // slow consumer slows the upload down rather than piling it up in memory,
+    // without holding a server thread.
+    std::function<bool(size_t size, std::function<void()> wake)> ready;
+};
+// Opens the sink of one upload, given the request headers and url
+// arguments.
+typedef std::function<UploadSink(
+    const std::string&, const POSTValues&, const httpi::PathParams&)>
+    UploadUrlHandler;
+
+// How the daemon waits for and dispatches connections. The historical setup is a
+// single internal select() thread running every handler, which lets one slow
+// page stall the whole dashboard.
+struct ServerConfig {
+    enum class EventLoop { kSelect, kPoll, kEpoll };
+
+    // kEpoll is Linux only.
+    EventLoop event_loop = EventLoop::kSelect;
+
+    // Number of internal threads, each running its own event loop and calling
+    // handlers. 1 means the single internal thread.
+    unsigned int thread_pool_size = 1;
+
+    // Spawn one thread per connection instead of an event loop thread pool.
+    // Incompatible with kEpoll and with thread_pool_size > 1: the server
+    // does not start, see HTTPServer::IsRunning().
+    bool thread_per_connection = false;
+
+    // Tag 200 responses that have no ETag with a hash of their body, so that
+    // clients reloading an unchanged page get a 304 without the body. Costs
+    // one pass over each body; streamed responses are never hashed.
+    bool etags = true;
+
+    // Compress bodies of at least compression_min_size bytes for clients
+    // accepting gzip or deflate. The compressed form of tagged responses is
+    // cached, up to compression_cache_bytes, so a given version of a page is
+    // compressed once. Streamed responses are sent as is.
+    bool compression = true;
+    size_t compression_min_size = 1024;
+    int compression_level = 6;
+    size_t compression_cache_bytes = 32 << 20;
+
+    // Serve the request counters of every route at this url, in the
+    // Prometheus text format. Empty to leave it out.
+    std::string metrics_url = "/metrics";
+
+    // Request bodies larger than this are refused with a 413, unless their
+    // route sets its own limit. Those declaring their size are refused before
+    // being read, the others when they go past it.
+    size_t max_body_size = 16 << 20;
+
+    // Overload protection; 0 means no limit, or MHD's default. MHD refuses
+    // connections past max_connections in total or max_connections_per_ip
+    // from one address, closes those idle for connection_timeout seconds,
+    // and gives each connection_memory_limit bytes to parse its request.
+    unsigned int max_connections = 0;
+    unsigned int max_connections_per_ip = 0;
+    unsigned int connection_timeout = 0;
+    size_t connection_memory_limit = 0;
+
+    // At most max_in_flight requests are between their handler being called
+    // and their response being ready, or its return for asynchronous ones,
+    // and uploads from before their sink is opened to their body's end; up
+    // to max_queued more wait for a slot, suspended, and the others get a 503
+    // with a Retry-After of retry_after seconds right away. The metrics url
+    // is exempt, to keep an overloaded server observable.
+    unsigned int max_in_flight = 0;
+    unsigned int max_queued = 0;
+    unsigned int retry_after = 1;
+
+    static ServerConfig ThreadPool(unsigned int threads) {
+        ServerConfig cfg;
+        cfg.event_loop = EventLoop::kEpoll;
+        cfg.thread_pool_size = threads;
+        return cfg;
+    }
+
+    static ServerConfig ThreadPerConnection() {
+        ServerConfig cfg;
+        cfg.event_loop = EventLoop::kPoll;
+        cfg.thread_per_connection = true;
+        return cfg;
+    }
+};
+
+class ConnInfoPool;
 
 class HTTPServer {
    public:
-    HTTPServer(int port);
+    HTTPServer(int port, const ServerConfig& config = ServerConfig());
     ~HTTPServer();
     void ServiceLoopForever();
 
-    void RegisterUrl(const std::string& str, UrlHandler f);
+    // `str` is a route pattern, see httpi::Router. Returns false if it is
+    // malformed or already registered. Routes can be added and removed while
+    // serving: requests in flight keep using the route table they started
+    // with.
+    //
+    // Asynchronous requests must all be completed before the server is
+    // destroyed.
+    bool RegisterUrl(const std::string& str, UrlHandler f);
+    bool RegisterUrl(const std::string& str, RoutedUrlHandler f);
+    bool RegisterAsyncUrl(const std::string& str, AsyncUrlHandler f);
+    // The handler gets the body piece by piece as it arrives instead of
+    // gathered in POSTValues, so that large uploads run in constant memory.
+    // `max_body_size` overrides ServerConfig::max_body_size for this route
+    // when not 0.
+    bool RegisterUploadUrl(const std::string& str,
+                           UploadUrlHandler f,
+                           size_t max_body_size = 0);
+    bool UnregisterUrl(const std::string& str);
 
     void StopService() {
         running_ = false;
         stop_signal_.notify_all();
     }
 
-    std::string Execute(const std::string& url,
-                        const std::string& method,
-                        const POSTValues& pv);
+    // Runs the handler for `url` and passes its response to `done`: before
+    // returning for a synchronous handler, whenever it completes for an
+    // asynchronous one.
+    void Execute(const std::string& url,
+                 const std::string& method,
+                 const POSTValues& pv,
+                 Responder done);
+
+    // Same, also setting `*route` to the metrics of the route serving the
+    // request before calling its handler.
+    void Execute(const std::string& url,
+                 const std::string& method,
+                 const POSTValues& pv,
+                 Responder done,
+                 httpi::RouteMetrics** route);
+
+    // Same, waiting for asynchronous handlers.
+    httpi::Response Execute(const std::string& url,
+                            const std::string& method,
+                            const POSTValues& pv);
+
+    // Returns whether `url` is routed to an upload handler, once its headers
+    // are in. In any case, sets `*max_body_size` to the body size limit of
+    // the route and `*route` to its metrics.
+    bool FindUpload(const std::string& url,
+                    size_t* max_body_size,
+                    httpi::RouteMetrics** route);
+
+    // Opens the sink of an upload to `url`, once the request is admitted and
+    // before its body is read. Returns false, leaving `sink` empty, if `url`
+    // is not routed to an upload handler.
+    bool OpenUpload(const std::string& url,
+                    const std::string& method,
+                    const POSTValues& headers,
+                    UploadSink* sink);
+
+    bool IsRunning() const { return running_; }
+    // Once destroying: requests are no longer suspended.
+    bool stopping() const { return stopping_; }
+    const ServerConfig& config() const { return config_; }
+    httpi::CompressionCache& compression_cache() { return compression_cache_; }
+    httpi::ServerMetrics& metrics() { return metrics_; }
+    httpi::Admission& admission() { return admission_; }
+    // Recycled per-request state, internal to the server.
+    ConnInfoPool& conn_pool() { return *conn_pool_; }
 
    private:
+    ServerConfig config_;
     MHD_Daemon* daemon_;
     bool running_;
-    mutable std::mutex cb_mutex_;
+    std::atomic<bool> stopping_{false};
     std::mutex stop_mutex_;
     std::condition_variable stop_signal_;
-    std::map<std::string, UrlHandler> callbacks_;
-    std::string error404_;
+
+    // Exactly one of the handlers is set.
+    struct Route {
+        RoutedUrlHandler handler;
+        AsyncUrlHandler async_handler;
+        UploadUrlHandler upload_handler;
+        // 0 for ServerConfig::max_body_size.
+        size_t max_body_size = 0;
+        httpi::RouteMetrics* metrics = nullptr;
+    };
+    bool AddRoute(const std::string& str, Route route);
+
+    typedef httpi::Router<Route> RouteTable;
+    // Read on every request without locking, copied and swapped on update.
+    httpi::AtomicSnapshot<RouteTable> callbacks_;
+    httpi::CompressionCache compression_cache_;
+    httpi::ServerMetrics metrics_;
+    httpi::RouteMetrics* unmatched_;
+    httpi::Admission admission_;
+    std::unique_ptr<ConnInfoPool> conn_pool_;
+    httpi::Response::Buffer error404_;
 };
@@ -0,0 +1,97 @@
+#include "events.h"
+
+#include <algorithm>
+
+namespace httpi {
+
+// Past that many bytes, a subscriber sends what it has before going on.
+static const size_t kMaxChunk = 32 * 1024;
+
+EventChannel::EventChannel(size_t history)
+    : state_(std::make_shared<State>(std::max<size_t>(1, history))) {}
+
+EventChannel::~EventChannel() { Close(); }
+
+void EventChannel::State::WakeAll(std::unique_lock<std::mutex>* lk) {
+    std::vector<std::function<void()>> wake;
+    wake.swap(waiting);
+    lk->unlock();
+    for (auto& w : wake) {
+        w();
+    }
+}
+
+void EventChannel::Publish(const std::string& event, const std::string& data) {
+    std::unique_lock<std::mutex> lk(state_->guard);
+    if (state_->closed) {
+        return;
+    }
+
+    std::string text = "id: " + std::to_string(state_->next_id++) + "\n";
+    if (!event.empty()) {
+        text += "event: " + event + "\n";
+    }
+    size_t begin = 0;
+    do {
+        size_t end = std::min(data.find('\n', begin), data.size());
+        text += "data: ";
+        text.append(data, begin, end - begin);
+        text += '\n';
+        begin = end + 1;
+    } while (begin <= data.size());
+    text += '\n';
+
+    state_->events.push_back(
+        std::make_shared<const std::string>(std::move(text)));
+    if (state_->events.size() > state_->history) {
+        state_->events.pop_front();
+    }
+    state_->WakeAll(&lk);
+}
+
+void EventChannel::Close() {
+    std::unique_lock<std::mutex> lk(state_->guard);
+    if (state_->closed) {
+        return;
+    }
+    state_->closed = true;
+    state_->WakeAll(&lk);
+}
+
+Response EventChannel::Subscribe(uint64_t last_event_id) {
+    uint64_t next;
+    {
+        std::lock_guard<std::mutex> lk(state_->guard);
+        next = last_event_id && last_event_id < state_->next_id
+                   ? last_event_id + 1
+                   : state_->next_id;
+        // Tells EventSource clients not to reconnect.
+        if (state_->closed && next == state_->next_id) {
+            return Response().Status(204);
+        }
+    }
+
+    auto state = state_;
+    return Response()
+        .Header("Content-Type", "text/event-stream")
+        .Header("Cache-Control", "no-cache")
+        .Pull([state, next](std::string* out,
+                            const std::function<void()>& wake) mutable {
+            std::lock_guard<std::mutex> lk(state->guard);
+            next = std::max(next, state->first_id());
+            while (next < state->next_id && out->size() < kMaxChunk) {
+                *out += *state->events[next - state->first_id()];
+                ++next;
+            }
+            if (!out->empty()) {
+                return Response::Pulled::kMore;
+            }
+            if (state->closed) {
+                return Response::Pulled::kEnd;
+            }
+            state->waiting.push_back(wake);
+            return Response::Pulled::kWait;
+        });
+}
+
+}  // httpi
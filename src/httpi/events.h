@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "response.h"
+
+namespace httpi {
+
+// Server-Sent Events published by one source to any number of subscribers.
+//
+// Publishing formats an event once and appends it to a bounded history
+// shared by every subscriber, which only keeps its position in it: the cost
+// of an event does not grow with the number of subscribers. Subscribers
+// waiting for the next event hold no thread, see Response::Pull. One falling
+// behind by more than the history skips what it missed.
+class EventChannel {
+   public:
+    explicit EventChannel(size_t history = 64);
+    // Ends the subscriptions, once they sent what was published.
+    ~EventChannel();
+
+    EventChannel(const EventChannel&) = delete;
+    EventChannel& operator=(const EventChannel&) = delete;
+
+    // Sends `data` as an event of type `event`, or of the default "message"
+    // type if empty. `data` may span several lines.
+    void Publish(const std::string& event, const std::string& data);
+
+    // Ends the subscriptions, once they sent what was published. Later
+    // events are dropped.
+    void Close();
+
+    // A text/event-stream response sending the events published from now
+    // on, or, for a client reconnecting with a Last-Event-ID header, those
+    // after that id that are still in the history. Once closed, with nothing
+    // left to send, a 204, which tells EventSource clients not to reconnect.
+    Response Subscribe(uint64_t last_event_id = 0);
+
+   private:
+    struct State {
+        std::mutex guard;
+        const size_t history;
+        // Formatted, by increasing id.
+        std::deque<Response::Buffer> events;
+        uint64_t next_id = 1;
+        bool closed = false;
+        // The subscribers waiting for the next event.
+        std::vector<std::function<void()>> waiting;
+
+        explicit State(size_t h) : history(h) {}
+
+        uint64_t first_id() const { return next_id - events.size(); }
+        void WakeAll(std::unique_lock<std::mutex>* lk);
+    };
+
+    // Shared with the subscriptions, which can outlive the channel.
+    std::shared_ptr<State> state_;
+};
+
+}  // httpi
@@ -0,0 +1,76 @@
+#include "events.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pulls what a subscription has to send, as the server would.
+static httpi::Response::Pulled Pull(httpi::Response& resp,
+                                    std::string* out,
+                                    int* woken) {
+    out->clear();
+    return resp.body().back().puller(out, [woken]() { ++*woken; });
+}
+
+int main() {
+    typedef httpi::Response::Pulled Pulled;
+    std::string out;
+    int woken = 0;
+
+    httpi::EventChannel channel(2);
+    channel.Publish("", "before");
+    httpi::Response sub = channel.Subscribe();
+    assert(sub.pulled());
+
+    // Only the events published after subscribing.
+    assert(Pull(sub, &out, &woken) == Pulled::kWait);
+    channel.Publish("state", "a\nb");
+    assert(woken == 1);
+    assert(Pull(sub, &out, &woken) == Pulled::kMore);
+    assert(out == "id: 2\nevent: state\ndata: a\ndata: b\n\n");
+
+    // A subscriber behind by more than the history skips the oldest.
+    channel.Publish("", "3");
+    channel.Publish("", "4");
+    channel.Publish("", "5");
+    assert(woken == 1);
+    assert(Pull(sub, &out, &woken) == Pulled::kMore);
+    assert(out == "id: 4\ndata: 4\n\nid: 5\ndata: 5\n\n");
+
+    // Reconnecting clients get what they missed, if still there.
+    httpi::Response again = channel.Subscribe(4);
+    assert(Pull(again, &out, &woken) == Pulled::kMore);
+    assert(out == "id: 5\ndata: 5\n\n");
+
+    // Closing lets subscribers finish, then ends them.
+    channel.Publish("", "6");
+    channel.Close();
+    assert(Pull(sub, &out, &woken) == Pulled::kMore);
+    assert(out == "id: 6\ndata: 6\n\n");
+    assert(Pull(sub, &out, &woken) == Pulled::kEnd);
+    assert(channel.Subscribe().status() == 204);
+
+    // Many subscribers, woken from another thread.
+    httpi::EventChannel live;
+    const int kSubscribers = 100;
+    std::vector<httpi::Response> subs;
+    for (int i = 0; i < kSubscribers; ++i) {
+        subs.push_back(live.Subscribe());
+    }
+    woken = 0;
+    for (auto& s : subs) {
+        assert(Pull(s, &out, &woken) == Pulled::kWait);
+    }
+    std::thread publisher([&live]() { live.Publish("tick", "1"); });
+    publisher.join();
+    assert(woken == kSubscribers);
+    for (auto& s : subs) {
+        assert(Pull(s, &out, &woken) == Pulled::kMore);
+        assert(out == "id: 1\nevent: tick\ndata: 1\n\n");
+    }
+
+    std::cout << "OK\n";
+    return 0;
+}
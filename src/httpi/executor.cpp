@@ -0,0 +1,109 @@
+#include "executor.h"
+
+#include <exception>
+#include <iostream>
+
+namespace httpi {
+
+// The executor and index of the worker running on this thread, if any.
+static thread_local const Executor* current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+Executor::Executor(unsigned threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back(new Worker);
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        threads_.emplace_back(&Executor::Loop, this, i);
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lk(idle_guard_);
+        stop_.store(true);
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) {
+        t.join();
+    }
+}
+
+void Executor::Submit(std::function<void()> task, Priority priority) {
+    size_t target =
+        current_executor == this
+            ? current_worker
+            : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+
+    {
+        Worker& w = *workers_[target];
+        std::lock_guard<std::mutex> lk(w.guard);
+        w.queues[static_cast<size_t>(priority)].push_back(std::move(task));
+    }
+    // Counting the task and then looking for parked threads, while a thread
+    // parking counts itself and then looks for tasks, both sequentially
+    // consistent: one of them sees the other. The lock orders the wake up
+    // after the wait.
+    pending_.fetch_add(1);
+    if (parked_.load() > 0) {
+        { std::lock_guard<std::mutex> lk(idle_guard_); }
+        wake_.notify_one();
+    }
+}
+
+bool Executor::Take(size_t self, std::function<void()>* task) {
+    for (size_t p = kPriorities; p-- > 0;) {
+        {
+            Worker& w = *workers_[self];
+            std::lock_guard<std::mutex> lk(w.guard);
+            if (!w.queues[p].empty()) {
+                *task = std::move(w.queues[p].front());
+                w.queues[p].pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lk(victim.guard);
+            if (!victim.queues[p].empty()) {
+                *task = std::move(victim.queues[p].back());
+                victim.queues[p].pop_back();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Executor::Loop(size_t self) {
+    current_executor = this;
+    current_worker = self;
+
+    while (!stop_.load(std::memory_order_relaxed)) {
+        std::function<void()> task;
+        if (!Take(self, &task)) {
+            std::unique_lock<std::mutex> lk(idle_guard_);
+            parked_.fetch_add(1);
+            wake_.wait(lk, [this]() {
+                return stop_.load() || pending_.load() > 0;
+            });
+            parked_.fetch_sub(1);
+            continue;
+        }
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        // A task throwing loses its work, not the thread, nor the process.
+        // Jobs catch their own exceptions, see Job::Run.
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "httpi: task failed: " << e.what() << "\n";
+        } catch (...) {
+            std::cerr << "httpi: task failed\n";
+        }
+    }
+}
+
+}  // httpi
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace httpi {
+
+enum class Priority { kLow, kNormal, kHigh };
+
+// A fixed set of threads running submitted tasks, highest priority first.
+//
+// Each thread has its own queues, one per priority. Tasks submitted from a
+// worker go to its own queues, others are spread round robin. A thread takes
+// the oldest task of its own queues and, when those are empty for a given
+// priority, steals the newest one of another thread before looking at lower
+// priorities. Submitting and taking a task only lock the queues they touch,
+// and count it with atomics: the shared lock is only taken to park a thread
+// with nothing to do, or to wake one up.
+class Executor {
+   public:
+    explicit Executor(unsigned threads);
+    // Drops the tasks not started yet and waits for the running ones.
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void Submit(std::function<void()> task, Priority priority);
+
+    unsigned threads() const { return threads_.size(); }
+
+   private:
+    static constexpr size_t kPriorities = 3;
+
+    struct Worker {
+        std::mutex guard;
+        std::deque<std::function<void()>> queues[kPriorities];
+    };
+
+    void Loop(size_t self);
+    bool Take(size_t self, std::function<void()>* task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_{0};
+
+    // Counts submitted tasks not taken yet; may briefly go below 0 when a
+    // task is taken before its submission is counted.
+    std::atomic<long> pending_{0};
+    // Threads parked, or about to, on `wake_`. Submissions only take the
+    // lock to wake one up when there are.
+    std::atomic<unsigned> parked_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex idle_guard_;
+    std::condition_variable wake_;
+};
+
+}  // httpi
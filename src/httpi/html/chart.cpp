@@ -52,7 +52,8 @@ std::string Chart::Get() const {
             Div().AddClass("ct-chart ct-golden-section").Id(name_) << Close() <<
         Close()).Get() +
         "<script>"
-            "new Chartist.Line('#" + name_ + "', {"
+            "window.charts = window.charts || {};"
+            "charts['" + name_ + "'] = new Chartist.Line('#" + name_ + "', {"
                 "labels: " + utils::ToJSONList(labels->second.begin(), labels->second.end()) + ", " +
                 "series: " + BuildSeries(values) +
             "});"
@@ -59,6 +59,8 @@ class Chart {
         return *this;
     }
 
+    // The chart and its script. The script also keeps the Chartist object in
+    // `charts[name]`, for pages updating it as new data comes.
     std::string Get() const;
 };
 
@@ -77,7 +77,9 @@ class FormDescriptor {
         return form_.MakeForm();
     }
 
-    std::pair<args_type, errorlog_type> Validate(const input_type& vs) const {
+    // `vs` maps argument names to values, like POSTValues.
+    template <class Input>
+    std::pair<args_type, errorlog_type> Validate(const Input& vs) const {
         std::vector<std::string> args_values;
         errorlog_type errors;
 
@@ -86,7 +88,8 @@ class FormDescriptor {
             if (arg_value == vs.end()) {
                 errors.push_back(a.name() + " missing in argument list");
             } else {
-                args_values.push_back(arg_value->second);
+                args_values.emplace_back(arg_value->second.data(),
+                                         arg_value->second.size());
             }
         }
 
@@ -123,7 +126,8 @@ class FormDescriptor<> {
         return Html();
     }
 
-    std::pair<args_type, errorlog_type> Validate(const input_type&) const {
+    template <class Input>
+    std::pair<args_type, errorlog_type> Validate(const Input&) const {
         return std::make_pair(std::tuple<>(), errorlog_type());
     }
 };
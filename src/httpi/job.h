@@ -1,72 +1,468 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <future>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cancel.h"
+#include "executor.h"
+
+enum class JobState { kQueued, kRunning, kFinished };
 
 template <class PackagedJob>
 class Job {
+    typedef std::chrono::system_clock::time_point time_point;
+
     std::unique_ptr<PackagedJob> job_;
-    std::future<void> future_;
-    std::chrono::system_clock::time_point start_;
-    mutable bool finished_ = false;
+    const std::shared_ptr<httpi::CancelToken> cancel_;
+    std::mutex on_finished_guard_;
+    std::vector<std::function<void()>> on_finished_;
+    bool done_ = false;
+    // Why Do() threw, if it did; set before `state_` becomes kFinished.
+    std::string error_;
+    // The times below are written before `state_` moves past them, and only
+    // read after it did.
+    std::atomic<JobState> state_;
+    const time_point queued_at_;
+    time_point started_at_;
+    time_point finished_at_;
 
    public:
-    Job(std::unique_ptr<PackagedJob> job)
+    Job(std::unique_ptr<PackagedJob> job,
+        std::shared_ptr<httpi::CancelToken> cancel)
         : job_(std::move(job)),
-          future_(
-              std::async(std::launch::async, &PackagedJob::Do, job_.get())) {}
+          cancel_(std::move(cancel)),
+          state_(JobState::kQueued),
+          queued_at_(std::chrono::system_clock::now()) {}
+
+    // Runs the job on this thread, unless it was cancelled while queued.
+    // Called once, by the JobPool's executor. A job which throws finishes
+    // like any other, with the exception's message as its error().
+    void Run() {
+        started_at_ = std::chrono::system_clock::now();
+        state_ = JobState::kRunning;
+        if (!cancel_->cancelled()) {
+            try {
+                job_->Do();
+            } catch (const std::exception& e) {
+                error_ = e.what();
+            } catch (...) {
+                error_ = "unknown exception";
+            }
+        }
+        finished_at_ = std::chrono::system_clock::now();
 
-    bool IsFinished() const {
-        if (finished_ == false) {
-            bool ended = future_.wait_for(std::chrono::seconds(0)) ==
-                         std::future_status::ready;
-            finished_ = ended;
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::lock_guard<std::mutex> lk(on_finished_guard_);
+            done_ = true;
+            callbacks.swap(on_finished_);
+        }
+        state_ = JobState::kFinished;
+        for (auto& f : callbacks) {
+            f();
         }
-        return finished_;
     }
 
+    // Calls `f` once the job is finished, from the job's thread, or right away
+    // from this one if it already is.
+    void OnFinished(std::function<void()> f) {
+        {
+            std::lock_guard<std::mutex> lk(on_finished_guard_);
+            if (!done_) {
+                on_finished_.push_back(std::move(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    // The job returns soon after, if it polls its token.
+    void Cancel(httpi::CancelToken::Reason reason =
+                    httpi::CancelToken::Reason::kCancelled) {
+        cancel_->Cancel(reason);
+    }
+    const httpi::CancelToken& cancel_token() const { return *cancel_; }
+
+    JobState state() const { return state_; }
+    bool IsFinished() const { return state_ == JobState::kFinished; }
+
+    time_point queued_at() const { return queued_at_; }
+    // Only meaningful once the job left the corresponding state.
+    time_point started_at() const { return started_at_; }
+    time_point finished_at() const { return finished_at_; }
+    // Once finished: empty unless the job threw.
+    const std::string& error() const { return error_; }
+
     PackagedJob& job_data() { return *job_; }
 };
 
+// What is left of a job evicted from its JobPool.
+struct JobSummary {
+    size_t id;
+    std::string summary;
+    std::chrono::system_clock::time_point queued_at;
+    std::chrono::system_clock::time_point started_at;
+    std::chrono::system_clock::time_point finished_at;
+};
+
+// Runs jobs on a bounded pool of threads: at most `max_concurrency` run at
+// once, the others wait in the queued state, highest priority first. A job
+// holds its thread until it returns, so long running jobs (like monitoring)
+// count against the limit for as long as they run.
+//
+// Finished jobs are kept according to a Retention policy; evicted ones leave
+// a summary in a bounded archive. Ids are never reused.
+//
+// Each job has a CancelToken, set when it is cancelled, when its deadline
+// passes or when the pool shuts down. Jobs cancelled while queued never run.
+//
+// The jobs are spread over shards with a lock each, held only to insert, find
+// or erase one job, or to copy the pointers of a shard. Listing the jobs works
+// on such a copy, so rendering them does not hold back submissions or lookups.
 template <class PackagedJob>
 class JobPool {
-    std::map<size_t, std::shared_ptr<Job<PackagedJob>>> jobs_;
-    mutable std::mutex jobs_guard_;
-
    public:
     typedef std::pair<const size_t, std::shared_ptr<Job<PackagedJob>>> job_type;
 
-    size_t StartJob(std::unique_ptr<PackagedJob> pj) {
-        std::lock_guard<std::mutex> lk(jobs_guard_);
+    // Limits on the finished jobs kept, each off when 0. Past any of them,
+    // the jobs which finished first are evicted.
+    struct Retention {
+        size_t max_finished = 0;
+        std::chrono::seconds max_age{0};
+        // Needs `result_bytes`.
+        size_t max_result_bytes = 0;
+        // The memory held by the results of a finished job.
+        std::function<size_t(PackagedJob&)> result_bytes;
+        // Kept in the archive once the job is evicted.
+        std::function<std::string(PackagedJob&)> summarize;
+        size_t max_archived = 1000;
+    };
+
+    explicit JobPool(unsigned max_concurrency = DefaultConcurrency(),
+                     Retention retention = Retention())
+        : retention_(std::move(retention)),
+          watchdog_(&JobPool::Watchdog, this),
+          executor_(max_concurrency) {}
+
+    // Cancels the jobs and waits for those running to return.
+    ~JobPool() {
+        Shutdown(std::chrono::seconds(0));
+        {
+            std::lock_guard<std::mutex> lk(deadlines_guard_);
+            stop_watchdog_ = true;
+        }
+        deadline_changed_.notify_all();
+        watchdog_.join();
+    }
+
+    static unsigned DefaultConcurrency() {
+        return std::max(2u, std::thread::hardware_concurrency());
+    }
 
-        size_t id = jobs_.size();
-        jobs_.emplace(std::piecewise_construct,
-                      std::forward_as_tuple(id),
-                      std::forward_as_tuple(
-                          std::make_shared<Job<PackagedJob>>(std::move(pj))));
+    // Cancels the job if it has not returned `timeout` after being started,
+    // unless 0. The job polls `cancel` if it was given one. `on_finished`, if
+    // given, is called once the job returns, before it can be evicted: unlike
+    // a callback registered through GetId(), it cannot miss a short job.
+    size_t StartJob(
+        std::unique_ptr<PackagedJob> pj,
+        httpi::Priority priority = httpi::Priority::kNormal,
+        std::chrono::steady_clock::duration timeout =
+            std::chrono::steady_clock::duration::zero(),
+        std::shared_ptr<httpi::CancelToken> cancel = nullptr,
+        std::function<void(Job<PackagedJob>&)> on_finished = nullptr) {
+        if (!cancel) {
+            cancel = std::make_shared<httpi::CancelToken>();
+        }
+        auto job = std::make_shared<Job<PackagedJob>>(std::move(pj),
+                                                      std::move(cancel));
+        if (on_finished) {
+            // The callback belongs to the job: it cannot outlive it.
+            Job<PackagedJob>* j = job.get();
+            job->OnFinished([j, on_finished]() { on_finished(*j); });
+        }
+        size_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        {
+            // Either Shutdown() finds the job registered, or the job finds
+            // the pool shut down.
+            std::lock_guard<std::mutex> lk(running_guard_);
+            if (shut_down_) {
+                job->Cancel(httpi::CancelToken::Reason::kShutdown);
+            }
+            Shard& shard = ShardOf(id);
+            std::lock_guard<std::mutex> shard_lk(shard.guard);
+            shard.jobs.emplace(id, job);
+            ++unfinished_;
+        }
+        size_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(retention_guard_);
+            Evict();
+        }
+        if (timeout != std::chrono::steady_clock::duration::zero()) {
+            std::lock_guard<std::mutex> lk(deadlines_guard_);
+            auto it = deadlines_.emplace(
+                std::chrono::steady_clock::now() + timeout, job);
+            if (it == deadlines_.begin()) {
+                deadline_changed_.notify_one();
+            }
+        }
+        executor_.Submit(
+            [this, job, id]() {
+                job->Run();
+                Finished(id, *job);
+            },
+            priority);
         return id;
     }
 
+    // Returns false if there is no such job, or if it finished already.
+    bool Cancel(size_t id) {
+        auto job = GetId(id);
+        if (!job || job->IsFinished()) {
+            return false;
+        }
+        job->Cancel();
+        return true;
+    }
+
+    // Cancels every job, those started later included, and waits up to
+    // `timeout` for them to return; queued ones return at once. Returns
+    // whether they all did. Those which did not hold their thread until they
+    // return, and the pool cannot be destroyed before.
+    template <class Rep, class Period>
+    bool Shutdown(std::chrono::duration<Rep, Period> timeout) {
+        {
+            std::lock_guard<std::mutex> lk(running_guard_);
+            shut_down_ = true;
+        }
+        for (auto& x : Snapshot()) {
+            x.second->Cancel(httpi::CancelToken::Reason::kShutdown);
+        }
+        std::unique_lock<std::mutex> lk(running_guard_);
+        return all_finished_.wait_for(
+            lk, timeout, [this]() { return unfinished_ == 0; });
+    }
+
+    // Runs `task` on the pool's threads, outside of any job: for jobs fanning
+    // out their work. Tasks not started when the pool goes away never run.
+    void Submit(std::function<void()> task,
+                httpi::Priority priority = httpi::Priority::kNormal) {
+        executor_.Submit(std::move(task), priority);
+    }
+
+    unsigned max_concurrency() const { return executor_.threads(); }
+
+    // The jobs by increasing id: every job started before the call, unless
+    // evicted meanwhile. Jobs started during the call may or may not be in.
+    std::vector<job_type> Snapshot() {
+        {
+            std::lock_guard<std::mutex> lk(retention_guard_);
+            Evict();
+        }
+
+        std::vector<std::pair<size_t, std::shared_ptr<Job<PackagedJob>>>> all;
+        all.reserve(size_.load(std::memory_order_relaxed));
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lk(shard.guard);
+            all.insert(all.end(), shard.jobs.begin(), shard.jobs.end());
+        }
+        std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+
+        std::vector<job_type> snapshot;
+        snapshot.reserve(all.size());
+        for (auto& x : all) {
+            snapshot.emplace_back(x.first, std::move(x.second));
+        }
+        return snapshot;
+    }
+
+    // Calls `f` on a Snapshot(), without holding any lock.
     template <class F>
     void foreach_job(F&& f) {
-        std::lock_guard<std::mutex> lk(jobs_guard_);
-
-        for (auto& x : jobs_) {
+        for (auto& x : Snapshot()) {
             f(x);
         }
     }
 
-    Job<PackagedJob>* GetId(size_t id) {
-        std::lock_guard<std::mutex> lk(jobs_guard_);
+    // Most recently evicted last.
+    template <class F>
+    void foreach_archived(F&& f) {
+        std::lock_guard<std::mutex> lk(retention_guard_);
 
-        auto res = jobs_.find(id);
-        if (res == jobs_.end()) {
+        for (auto& s : archive_) {
+            f(s);
+        }
+    }
+
+    // Returns nullptr if there is no such job, or no more.
+    std::shared_ptr<Job<PackagedJob>> GetId(size_t id) {
+        Shard& shard = ShardOf(id);
+        std::lock_guard<std::mutex> lk(shard.guard);
+
+        auto res = shard.jobs.find(id);
+        if (res == shard.jobs.end()) {
             return nullptr;
         } else {
-            return res->second.get();
+            return res->second;
         }
     }
+
+    // Finds the summary of an evicted job still in the archive.
+    bool GetArchived(size_t id, JobSummary* out) {
+        std::lock_guard<std::mutex> lk(retention_guard_);
+
+        for (auto& s : archive_) {
+            if (s.id == id) {
+                *out = s;
+                return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    static constexpr size_t kShards = 16;
+
+    struct Shard {
+        std::mutex guard;
+        std::unordered_map<size_t, std::shared_ptr<Job<PackagedJob>>> jobs;
+    };
+
+    struct Finish {
+        size_t id;
+        size_t bytes;
+    };
+
+    // Consecutive ids go to different shards.
+    Shard& ShardOf(size_t id) { return shards_[id % kShards]; }
+
+    void Finished(size_t id, Job<PackagedJob>& job) {
+        size_t bytes =
+            retention_.result_bytes ? retention_.result_bytes(job.job_data())
+                                    : 0;
+        {
+            std::lock_guard<std::mutex> lk(retention_guard_);
+            finished_.push_back(Finish{id, bytes});
+            result_bytes_ += bytes;
+            Evict();
+        }
+        std::lock_guard<std::mutex> lk(running_guard_);
+        if (--unfinished_ == 0) {
+            all_finished_.notify_all();
+        }
+    }
+
+    // Cancels the jobs past their deadline.
+    void Watchdog() {
+        std::unique_lock<std::mutex> lk(deadlines_guard_);
+        while (!stop_watchdog_) {
+            if (deadlines_.empty()) {
+                deadline_changed_.wait(lk);
+                continue;
+            }
+            auto first = deadlines_.begin();
+            if (std::chrono::steady_clock::now() < first->first) {
+                deadline_changed_.wait_until(lk, first->first);
+                continue;
+            }
+            std::shared_ptr<Job<PackagedJob>> job = first->second.lock();
+            deadlines_.erase(first);
+            if (job && !job->IsFinished()) {
+                lk.unlock();
+                job->Cancel(httpi::CancelToken::Reason::kDeadline);
+                lk.lock();
+            }
+        }
+    }
+
+    // Drops the oldest finished jobs past the retention limits. Called with
+    // `retention_guard_` held.
+    void Evict() {
+        auto now = std::chrono::system_clock::now();
+        while (!finished_.empty()) {
+            const Finish& oldest = finished_.front();
+            // Only evicted here, so still registered.
+            std::shared_ptr<Job<PackagedJob>> found = GetId(oldest.id);
+            Job<PackagedJob>& job = *found;
+
+            bool evict =
+                (retention_.max_finished &&
+                 finished_.size() > retention_.max_finished) ||
+                (retention_.max_age.count() &&
+                 now - job.finished_at() > retention_.max_age) ||
+                (retention_.max_result_bytes &&
+                 result_bytes_ > retention_.max_result_bytes);
+            if (!evict) {
+                return;
+            }
+
+            if (retention_.max_archived) {
+                archive_.push_back(JobSummary{
+                    oldest.id,
+                    retention_.summarize
+                        ? retention_.summarize(job.job_data())
+                        : std::string(),
+                    job.queued_at(),
+                    job.started_at(),
+                    job.finished_at()});
+                if (archive_.size() > retention_.max_archived) {
+                    archive_.pop_front();
+                }
+            }
+            result_bytes_ -= oldest.bytes;
+            {
+                Shard& shard = ShardOf(oldest.id);
+                std::lock_guard<std::mutex> lk(shard.guard);
+                shard.jobs.erase(oldest.id);
+            }
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            finished_.pop_front();
+        }
+    }
+
+    const Retention retention_;
+    Shard shards_[kShards];
+    std::atomic<size_t> next_id_{0};
+    // Jobs registered, to size snapshots.
+    std::atomic<size_t> size_{0};
+
+    // Guards the members below. Taken before a shard's lock, never after.
+    std::mutex retention_guard_;
+    // Finished jobs still registered, in the order they finished.
+    std::deque<Finish> finished_;
+    size_t result_bytes_ = 0;
+    std::deque<JobSummary> archive_;
+
+    // Guards the members below. Taken before a shard's lock, never after.
+    std::mutex running_guard_;
+    bool shut_down_ = false;
+    // Jobs started and not finished yet.
+    std::condition_variable all_finished_;
+    size_t unfinished_ = 0;
+
+    std::mutex deadlines_guard_;
+    std::condition_variable deadline_changed_;
+    std::multimap<std::chrono::steady_clock::time_point,
+                  std::weak_ptr<Job<PackagedJob>>>
+        deadlines_;
+    bool stop_watchdog_ = false;
+    std::thread watchdog_;
+
+    // Last, to be stopped before the jobs go away.
+    httpi::Executor executor_;
 };
@@ -0,0 +1,257 @@
+#include "journal.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace httpi {
+
+static const char kFileMagic[8] = {'h', 't', 't', 'p', 'i', 'j', 'n', '1'};
+static const uint32_t kRecordMagic = 0x7265636a;
+
+enum RecordType : uint32_t { kCheckpoint = 1, kEnd = 2 };
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t key;
+    uint32_t kind_size;
+    uint32_t data_size;
+    // Over the header, with this field 0, and the payload.
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+static size_t Align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+static size_t RecordSize(const RecordHeader& h) {
+    return sizeof(RecordHeader) + Align8(size_t(h.kind_size) + h.data_size);
+}
+
+static uint32_t RecordCrc(RecordHeader h, const char* payload) {
+    h.crc = 0;
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(&h), sizeof(h));
+    return crc32(crc,
+                 reinterpret_cast<const Bytef*>(payload),
+                 h.kind_size + h.data_size);
+}
+
+// Opens `path` and maps at least `size` bytes of it, growing it if needed.
+static bool MapFile(const std::string& path,
+                    size_t size,
+                    int* fd,
+                    char** base,
+                    size_t* mapped) {
+    *fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (*fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(*fd, &st) != 0) {
+        close(*fd);
+        return false;
+    }
+    size = std::max(size, static_cast<size_t>(st.st_size));
+    if (static_cast<size_t>(st.st_size) < size &&
+        ftruncate(*fd, size) != 0) {
+        close(*fd);
+        return false;
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (p == MAP_FAILED) {
+        close(*fd);
+        return false;
+    }
+    *base = static_cast<char*>(p);
+    *mapped = size;
+    return true;
+}
+
+std::unique_ptr<Journal> Journal::Open(const std::string& path,
+                                       size_t capacity) {
+    int fd;
+    char* base;
+    size_t size;
+    if (!MapFile(path,
+                 std::max(capacity, sizeof(kFileMagic) + sizeof(RecordHeader)),
+                 &fd,
+                 &base,
+                 &size)) {
+        return nullptr;
+    }
+    std::unique_ptr<Journal> j(new Journal(path, fd, base, size));
+    j->Scan();
+    return j;
+}
+
+Journal::Journal(std::string path, int fd, char* base, size_t size)
+    : path_(std::move(path)), fd_(fd), base_(base), size_(size), end_(0) {}
+
+Journal::~Journal() {
+    munmap(base_, size_);
+    close(fd_);
+}
+
+void Journal::Scan() {
+    if (std::memcmp(base_, kFileMagic, sizeof(kFileMagic)) != 0) {
+        // New, or not a journal: start over.
+        std::memset(base_, 0, size_);
+        std::memcpy(base_, kFileMagic, sizeof(kFileMagic));
+        end_ = sizeof(kFileMagic);
+        return;
+    }
+
+    size_t offset = sizeof(kFileMagic);
+    while (offset + sizeof(RecordHeader) <= size_) {
+        RecordHeader h;
+        std::memcpy(&h, base_ + offset, sizeof(h));
+        if (h.magic != kRecordMagic || RecordSize(h) > size_ - offset ||
+            RecordCrc(h, base_ + offset + sizeof(h)) != h.crc) {
+            break;
+        }
+        if (h.type == kCheckpoint) {
+            live_[h.key] = offset;
+        } else {
+            live_.erase(h.key);
+        }
+        next_key_ = std::max(next_key_, h.key + 1);
+        offset += RecordSize(h);
+    }
+    end_ = offset;
+    // Whatever follows is a torn record: clear it so that it is not taken
+    // for one once partly overwritten.
+    std::memset(base_ + end_, 0, size_ - end_);
+}
+
+std::vector<Journal::Entry> Journal::Live() {
+    std::lock_guard<std::mutex> lk(guard_);
+    std::vector<Entry> entries;
+    for (auto& l : live_) {
+        RecordHeader h;
+        std::memcpy(&h, base_ + l.second, sizeof(h));
+        const char* payload = base_ + l.second + sizeof(h);
+        entries.push_back(Entry{h.key,
+                                std::string(payload, h.kind_size),
+                                std::string(payload + h.kind_size,
+                                            h.data_size)});
+    }
+    return entries;
+}
+
+uint64_t Journal::NewKey() {
+    std::lock_guard<std::mutex> lk(guard_);
+    return next_key_++;
+}
+
+bool Journal::Checkpoint(uint64_t key,
+                         const std::string& kind,
+                         const std::string& data) {
+    std::lock_guard<std::mutex> lk(guard_);
+    return Append(kCheckpoint, key, kind, data);
+}
+
+bool Journal::End(uint64_t key) {
+    std::lock_guard<std::mutex> lk(guard_);
+    if (live_.find(key) == live_.end()) {
+        return true;
+    }
+    return Append(kEnd, key, std::string(), std::string());
+}
+
+bool Journal::Sync() {
+    std::lock_guard<std::mutex> lk(guard_);
+    return msync(base_, end_, MS_SYNC) == 0;
+}
+
+bool Journal::Append(uint32_t type,
+                     uint64_t key,
+                     const std::string& kind,
+                     const std::string& data) {
+    RecordHeader h;
+    h.magic = kRecordMagic;
+    h.type = type;
+    h.key = key;
+    h.kind_size = kind.size();
+    h.data_size = data.size();
+    h.reserved = 0;
+
+    size_t size = RecordSize(h);
+    if (end_ + size > size_ && !Compact(size)) {
+        return false;
+    }
+
+    // The payload first and the header last, so that a record cut short
+    // never looks complete.
+    char* rec = base_ + end_;
+    std::memcpy(rec + sizeof(h), kind.data(), kind.size());
+    std::memcpy(rec + sizeof(h) + kind.size(), data.data(), data.size());
+    h.crc = RecordCrc(h, rec + sizeof(h));
+    std::memcpy(rec, &h, sizeof(h));
+
+    if (type == kCheckpoint) {
+        live_[key] = end_;
+    } else {
+        live_.erase(key);
+    }
+    next_key_ = std::max(next_key_, key + 1);
+    end_ += size;
+    return true;
+}
+
+bool Journal::Compact(size_t needed) {
+    size_t live_bytes = sizeof(kFileMagic);
+    for (auto& l : live_) {
+        RecordHeader h;
+        std::memcpy(&h, base_ + l.second, sizeof(h));
+        live_bytes += RecordSize(h);
+    }
+    // Keep at least half of the file free, so that compactions stay rare.
+    size_t size = std::max(size_, 2 * (live_bytes + needed));
+
+    std::string tmp = path_ + ".tmp";
+    unlink(tmp.c_str());
+    int fd;
+    char* base;
+    size_t mapped;
+    if (!MapFile(tmp, size, &fd, &base, &mapped)) {
+        return false;
+    }
+
+    std::memcpy(base, kFileMagic, sizeof(kFileMagic));
+    size_t end = sizeof(kFileMagic);
+    for (auto& l : live_) {
+        RecordHeader h;
+        std::memcpy(&h, base_ + l.second, sizeof(h));
+        size_t rec = RecordSize(h);
+        std::memcpy(base + end, base_ + l.second, rec);
+        l.second = end;
+        end += rec;
+    }
+
+    if (msync(base, end, MS_SYNC) != 0 ||
+        rename(tmp.c_str(), path_.c_str()) != 0) {
+        munmap(base, mapped);
+        close(fd);
+        unlink(tmp.c_str());
+        // The offsets in `live_` were moved to the new file: scan the old
+        // one again to get them back.
+        live_.clear();
+        Scan();
+        return false;
+    }
+
+    munmap(base_, size_);
+    close(fd_);
+    fd_ = fd;
+    base_ = base;
+    size_ = mapped;
+    end_ = end;
+    return true;
+}
+
+}  // httpi
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace httpi {
+
+// An append-only log of job checkpoints in a memory-mapped file, so that
+// jobs can resume where they were after the process restarts.
+//
+// Writing a checkpoint is a copy into the mapping: the kernel writes it back
+// to the file, and it survives the process crashing (Sync() to also survive
+// the machine crashing). Each record is checksummed; a record torn by a crash
+// and everything after it are ignored when the journal is opened again. Once
+// the file is full, the last checkpoint of each job still running is copied
+// to a new file which replaces it.
+class Journal {
+   public:
+    struct Entry {
+        uint64_t key;
+        std::string kind;
+        std::string data;
+    };
+
+    // Opens the journal at `path`, creating it if needed. Returns nullptr if
+    // the file cannot be opened or mapped.
+    static std::unique_ptr<Journal> Open(const std::string& path,
+                                         size_t capacity = 1 << 20);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // The last checkpoint of every key not ended, by increasing key.
+    std::vector<Entry> Live();
+
+    // A key not used by any record yet.
+    uint64_t NewKey();
+
+    // Supersedes the previous checkpoint of `key`. Returns false if it
+    // could not be written.
+    bool Checkpoint(uint64_t key,
+                    const std::string& kind,
+                    const std::string& data);
+    // Forgets `key`: it will not be in Live() any more.
+    bool End(uint64_t key);
+
+    // Waits for the records written so far to be on disk.
+    bool Sync();
+
+   private:
+    Journal(std::string path, int fd, char* base, size_t size);
+
+    void Scan();
+    bool Append(uint32_t type,
+                uint64_t key,
+                const std::string& kind,
+                const std::string& data);
+    // Rewrites the live records to a new file with room for `needed` more
+    // bytes, and switches to it.
+    bool Compact(size_t needed);
+
+    std::mutex guard_;
+    const std::string path_;
+    int fd_;
+    char* base_;
+    size_t size_;
+    // Where the next record goes.
+    size_t end_;
+    uint64_t next_key_ = 1;
+    // The offset of the last checkpoint of each live key.
+    std::map<uint64_t, size_t> live_;
+};
+
+}  // httpi
@@ -0,0 +1,107 @@
+#include "journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+int main() {
+    char dir[] = "/tmp/journal_testXXXXXX";
+    assert(mkdtemp(dir));
+    std::string path = std::string(dir) + "/jobs.journal";
+
+    {
+        auto j = httpi::Journal::Open(path, 4096);
+        assert(j);
+        assert(j->Live().empty());
+        uint64_t a = j->NewKey(), b = j->NewKey(), c = j->NewKey();
+        assert(a != b && b != c);
+        assert(j->Checkpoint(a, "permute", "a1"));
+        assert(j->Checkpoint(b, "permute", "b1"));
+        assert(j->Checkpoint(c, "count", "c1"));
+        assert(j->Checkpoint(a, "permute", "a2"));
+        assert(j->End(b));
+    }
+
+    // Reopened, only the last checkpoint of what did not end is left.
+    uint64_t next;
+    {
+        auto j = httpi::Journal::Open(path, 4096);
+        auto live = j->Live();
+        assert(live.size() == 2);
+        assert(live[0].kind == "permute" && live[0].data == "a2");
+        assert(live[1].kind == "count" && live[1].data == "c1");
+        // Keys are not reused across runs.
+        next = j->NewKey();
+        assert(next > live[1].key);
+
+        // Many more checkpoints than the file holds: it is compacted.
+        std::string data(100, 'x');
+        for (int i = 0; i < 1000; ++i) {
+            assert(j->Checkpoint(next, "permute", data + std::to_string(i)));
+        }
+        assert(j->Sync());
+    }
+
+    {
+        auto j = httpi::Journal::Open(path, 4096);
+        auto live = j->Live();
+        assert(live.size() == 3);
+        assert(live[2].key == next && live[2].data.size() == 103);
+        assert(live[2].data.substr(100) == "999");
+        assert(j->End(live[0].key));
+    }
+
+    // A record torn by a crash is ignored, with what comes after it.
+    {
+        int fd = open(path.c_str(), O_RDWR);
+        assert(fd >= 0);
+        off_t size = lseek(fd, 0, SEEK_END);
+        char buf[4096];
+        assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        // The last record is the End: corrupt its payload-less header.
+        off_t end = 0;
+        for (off_t i = sizeof(buf) - 1; i > 0; --i) {
+            if (buf[i] != 0) {
+                end = i;
+                break;
+            }
+        }
+        assert(end > 0 && end < size);
+        char garbage = buf[end] ^ 0x5a;
+        assert(pwrite(fd, &garbage, 1, end) == 1);
+        close(fd);
+
+        auto j = httpi::Journal::Open(path, 4096);
+        assert(j->Live().size() == 3);
+        assert(j->Checkpoint(next, "permute", "after"));
+        auto live = j->Live();
+        assert(live.size() == 3 && live[2].data == "after");
+    }
+
+    {
+        auto j = httpi::Journal::Open(path, 4096);
+        assert(j->Live().size() == 3);
+    }
+
+    // Not a journal: started over.
+    {
+        std::string other = std::string(dir) + "/other";
+        FILE* f = fopen(other.c_str(), "w");
+        fputs("not a journal", f);
+        fclose(f);
+        auto j = httpi::Journal::Open(other);
+        assert(j && j->Live().empty());
+        unlink(other.c_str());
+    }
+
+    assert(!httpi::Journal::Open(std::string(dir) + "/missing/dir/x"));
+
+    unlink(path.c_str());
+    rmdir(dir);
+    std::cout << "OK\n";
+    return 0;
+}
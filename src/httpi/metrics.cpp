@@ -0,0 +1,137 @@
+#include "metrics.h"
+
+#include <cstdio>
+
+namespace httpi {
+
+RouteMetrics::RouteMetrics() {
+    for (auto& s : stripes_) {
+        for (auto& r : s.requests) {
+            r.store(0, std::memory_order_relaxed);
+        }
+        s.bytes.store(0, std::memory_order_relaxed);
+        s.latency_ns.store(0, std::memory_order_relaxed);
+        for (auto& b : s.latency) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+RouteMetrics::Totals RouteMetrics::Read() const {
+    Totals t;
+    for (auto& s : stripes_) {
+        for (size_t i = 0; i < kStatusClasses; ++i) {
+            t.requests[i] += s.requests[i].load(std::memory_order_relaxed);
+        }
+        t.bytes += s.bytes.load(std::memory_order_relaxed);
+        t.latency_ns += s.latency_ns.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= LatencyBuckets::kCount; ++i) {
+            t.latency[i] += s.latency[i].load(std::memory_order_relaxed);
+        }
+    }
+    return t;
+}
+
+RouteMetrics* ServerMetrics::ForRoute(const std::string& pattern) {
+    std::lock_guard<std::mutex> lk(guard_);
+    auto& m = routes_[pattern];
+    if (!m) {
+        m.reset(new RouteMetrics);
+    }
+    return m.get();
+}
+
+// Quotes a label value.
+static std::string Label(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+void ServerMetrics::WritePrometheus(std::string* out) const {
+    std::map<std::string, RouteMetrics::Totals> totals;
+    {
+        std::lock_guard<std::mutex> lk(guard_);
+        for (auto& r : routes_) {
+            totals.emplace(r.first, r.second->Read());
+        }
+    }
+
+    char line[1024];
+    *out +=
+        "# HELP httpi_requests_total Requests answered, by route and status "
+        "class. The empty route counts requests that matched none.\n"
+        "# TYPE httpi_requests_total counter\n";
+    for (auto& t : totals) {
+        for (size_t i = 0; i < RouteMetrics::kStatusClasses; ++i) {
+            std::snprintf(line,
+                          sizeof(line),
+                          "httpi_requests_total{route=%s,code=\"%zuxx\"} %llu\n",
+                          Label(t.first).c_str(),
+                          i + 1,
+                          (unsigned long long)t.second.requests[i]);
+            *out += line;
+        }
+    }
+
+    *out +=
+        "# HELP httpi_response_bytes_total Body bytes sent, after "
+        "compression.\n"
+        "# TYPE httpi_response_bytes_total counter\n";
+    for (auto& t : totals) {
+        std::snprintf(line,
+                      sizeof(line),
+                      "httpi_response_bytes_total{route=%s} %llu\n",
+                      Label(t.first).c_str(),
+                      (unsigned long long)t.second.bytes);
+        *out += line;
+    }
+
+    // Buckets past the slowest request are all equal to the count: leave them
+    // out rather than print a hundred lines per idle route.
+    *out +=
+        "# HELP httpi_request_duration_seconds Time from the end of the "
+        "request to its response being queued.\n"
+        "# TYPE httpi_request_duration_seconds histogram\n";
+    for (auto& t : totals) {
+        std::string route = Label(t.first);
+        size_t last = 0;
+        for (size_t i = 0; i < LatencyBuckets::kCount; ++i) {
+            if (t.second.latency[i]) {
+                last = i;
+            }
+        }
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i <= last; ++i) {
+            cumulative += t.second.latency[i];
+            std::snprintf(line,
+                          sizeof(line),
+                          "httpi_request_duration_seconds_bucket{route=%s,"
+                          "le=\"%.6f\"} %llu\n",
+                          route.c_str(),
+                          LatencyBuckets::Bound(i) / 1e6,
+                          (unsigned long long)cumulative);
+            *out += line;
+        }
+        std::snprintf(line,
+                      sizeof(line),
+                      "httpi_request_duration_seconds_bucket{route=%s,"
+                      "le=\"+Inf\"} %llu\n"
+                      "httpi_request_duration_seconds_sum{route=%s} %.9f\n"
+                      "httpi_request_duration_seconds_count{route=%s} %llu\n",
+                      route.c_str(),
+                      (unsigned long long)t.second.count(),
+                      route.c_str(),
+                      t.second.latency_ns / 1e9,
+                      route.c_str(),
+                      (unsigned long long)t.second.count());
+        *out += line;
+    }
+}
+
+}  // httpi
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace httpi {
+
+// Latency buckets in microseconds, log-linear like an HDR histogram: each
+// power of two is cut in kSubBuckets equal buckets, so a bucket is never wider
+// than a quarter of its bound. The last bound is a bit over a minute; slower
+// requests only count in the implicit +Inf bucket.
+struct LatencyBuckets {
+    static constexpr int kSubBits = 2;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBits;
+    static constexpr int kMaxMagnitude = 26;
+    static constexpr size_t kCount =
+        kSubBuckets + (kMaxMagnitude - kSubBits) * kSubBuckets;
+
+    // The bucket counting `us`, that is the first whose bound is >= us, or
+    // kCount if there is none.
+    static size_t Index(uint64_t us) {
+        if (us == 0) {
+            return 0;
+        }
+        uint64_t x = us - 1;
+        if (x < kSubBuckets) {
+            return x;
+        }
+        int magnitude = 63 - __builtin_clzll(x);
+        if (magnitude >= kMaxMagnitude) {
+            return kCount;
+        }
+        size_t sub = (x >> (magnitude - kSubBits)) - kSubBuckets;
+        return kSubBuckets + (magnitude - kSubBits) * kSubBuckets + sub;
+    }
+
+    // The largest value counted in bucket `i`, in microseconds.
+    static uint64_t Bound(size_t i) {
+        if (i < kSubBuckets) {
+            return i + 1;
+        }
+        size_t k = i - kSubBuckets;
+        int shift = k / kSubBuckets;
+        uint64_t sub = k % kSubBuckets;
+        return (kSubBuckets + sub + 1) << shift;
+    }
+};
+
+// Counters of the requests served by one route.
+//
+// Recording is a handful of relaxed atomic increments, and never contends:
+// the counters are striped, each thread adding to its own stripe, and only
+// the (rare) reader sums the stripes.
+class RouteMetrics {
+   public:
+    static constexpr size_t kStripes = 16;
+    // 1xx to 5xx.
+    static constexpr size_t kStatusClasses = 5;
+
+    struct Totals {
+        uint64_t requests[kStatusClasses] = {};
+        uint64_t bytes = 0;
+        uint64_t latency_ns = 0;
+        uint64_t latency[LatencyBuckets::kCount + 1] = {};
+
+        uint64_t count() const {
+            uint64_t n = 0;
+            for (auto r : requests) {
+                n += r;
+            }
+            return n;
+        }
+    };
+
+    RouteMetrics();
+    RouteMetrics(const RouteMetrics&) = delete;
+    RouteMetrics& operator=(const RouteMetrics&) = delete;
+
+    // Counts one answered request: its status, the time taken to answer it
+    // and the size of its body. Bytes produced by streamed parts are added
+    // later with AddBytes().
+    void Record(int status, uint64_t latency_ns, uint64_t bytes) {
+        Stripe& s = stripes_[ThisThreadStripe()];
+        int cls = status / 100 - 1;
+        cls = cls < 0 ? 0 : cls >= int(kStatusClasses) ? kStatusClasses - 1
+                                                         : cls;
+        s.requests[cls].fetch_add(1, std::memory_order_relaxed);
+        s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        s.latency_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+        s.latency[LatencyBuckets::Index(latency_ns / 1000)].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+
+    void AddBytes(uint64_t bytes) {
+        stripes_[ThisThreadStripe()].bytes.fetch_add(
+            bytes, std::memory_order_relaxed);
+    }
+
+    // Sums the stripes. Concurrent records may or may not be included.
+    Totals Read() const;
+
+   private:
+    struct Stripe {
+        std::atomic<uint64_t> requests[kStatusClasses];
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> latency_ns;
+        std::atomic<uint64_t> latency[LatencyBuckets::kCount + 1];
+        // Keeps the hot head of the next stripe off our last cache line.
+        char padding[64];
+    };
+
+    static size_t ThisThreadStripe() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t stripe =
+            next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+        return stripe;
+    }
+
+    Stripe stripes_[kStripes];
+};
+
+// The metrics of every route a server ever had, by pattern. Those of an
+// unregistered route are kept, so that counters never go backwards.
+class ServerMetrics {
+   public:
+    // Stable for the lifetime of this object. The empty pattern stands for
+    // requests matching no route.
+    RouteMetrics* ForRoute(const std::string& pattern);
+
+    // Appends all counters in the Prometheus text exposition format.
+    void WritePrometheus(std::string* out) const;
+
+   private:
+    mutable std::mutex guard_;
+    std::map<std::string, std::unique_ptr<RouteMetrics>> routes_;
+};
+
+}  // httpi
@@ -0,0 +1,50 @@
+#include "metrics.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+int main() {
+    typedef httpi::LatencyBuckets B;
+
+    // Every value lands in the first bucket whose bound covers it.
+    for (uint64_t us = 0; us < (uint64_t(1) << 20); ++us) {
+        size_t i = B::Index(us);
+        assert(i < B::kCount);
+        assert(us <= B::Bound(i));
+        assert(i == 0 || us > B::Bound(i - 1));
+    }
+    assert(B::Bound(B::kCount - 1) == uint64_t(1) << B::kMaxMagnitude);
+    assert(B::Index(uint64_t(1) << B::kMaxMagnitude) == B::kCount - 1);
+    assert(B::Index((uint64_t(1) << B::kMaxMagnitude) + 1) == B::kCount);
+
+    httpi::ServerMetrics metrics;
+    httpi::RouteMetrics* jobs = metrics.ForRoute("/jobs/:id");
+    assert(metrics.ForRoute("/jobs/:id") == jobs);
+
+    jobs->Record(200, 1500, 100);
+    jobs->Record(304, 2500, 0);
+    jobs->Record(404, 2000000, 10);
+    jobs->AddBytes(5);
+    auto t = jobs->Read();
+    assert(t.count() == 3);
+    assert(t.requests[1] == 1 && t.requests[2] == 1 && t.requests[3] == 1);
+    assert(t.bytes == 115);
+    assert(t.latency_ns == 2004000);
+    // Truncated to whole microseconds.
+    assert(t.latency[B::Index(1)] == 1);
+    assert(t.latency[B::Index(2)] == 1);
+    assert(t.latency[B::Index(2000)] == 1);
+
+    std::string text;
+    metrics.WritePrometheus(&text);
+    assert(text.find("httpi_requests_total{route=\"/jobs/:id\",code=\"2xx\"} "
+                     "1\n") != std::string::npos);
+    assert(text.find("httpi_request_duration_seconds_bucket{route=\"/jobs/"
+                     ":id\",le=\"+Inf\"} 3\n") != std::string::npos);
+    assert(text.find("httpi_request_duration_seconds_count{route=\"/jobs/"
+                     ":id\"} 3\n") != std::string::npos);
+
+    std::cout << "OK\n";
+    return 0;
+}
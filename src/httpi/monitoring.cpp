@@ -1,8 +1,10 @@
-#include <fstream>
-#include <iomanip>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ctime>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "displayer.h"
@@ -10,75 +12,223 @@
 #include "html/html.h"
 #include "job.h"
 #include "monitoring.h"
+#include "proc-sampler.h"
 
 using namespace httpi::html;
 
-MonitoringJob::Stats MonitoringJob::GetMonitoringStats() const {
-    static const int kUserTimeIndex = 14;
-    static const int kKernelTimeIndex = 15;
-    static const int kVirtualSizeIndex = 23;
-
-    std::ifstream stat("/proc/self/stat");
-    Stats s;
-
-    int i = 1;
-    while (stat) {
-        if (i == kUserTimeIndex)
-            stat >> s.utime;
-        else if (i == kKernelTimeIndex)
-            stat >> s.stime;
-        else if (i == kVirtualSizeIndex)
-            stat >> s.vsize;
-        else if (i == 2 || i == 3) {
-            std::string ignore;
-            stat >> ignore;
-        } else {
-            size_t ignore;
-            stat >> ignore;
-        }
-
-        ++i;
-    }
-    return s;
+std::string MonitoringJob::LiveScript(const std::string& events_url) const {
+    return "<script>(function() {"
+           "var es = new EventSource('" + events_url + "');"
+           "es.addEventListener('sample', function(e) {"
+           "var s = JSON.parse(e.data);"
+           "[['RAM_usage', s.time, [s.ram]], ['CPU_usage', s.time, [s.cpu]],"
+           " ['IO', s.io_time, [s.read, s.write]]].forEach(function(c) {"
+           "var chart = window.charts && charts[c[0]];"
+           "if (!chart || !c[1]) { return; }"
+           "var d = chart.data;"
+           "var n = d.labels.length;"
+           "if (n && d.labels[n - 1] === c[1]) {"
+           "c[2].forEach(function(v, i) { d.series[i][n - 1] = v; });"
+           "} else {"
+           "d.labels.push(c[1]);"
+           "c[2].forEach(function(v, i) { d.series[i].push(v); });"
+           "}"
+           "if (d.labels.length > " + std::to_string(history_size_) + ") {"
+           "d.labels.shift();"
+           "d.series.forEach(function(x) { x.shift(); });"
+           "}"
+           "chart.update(d);"
+           "});"
+           "document.querySelectorAll('[data-stat]').forEach(function(td) {"
+           "td.textContent = s[td.dataset.stat];"
+           "});"
+           "});"
+           "})();</script>";
 }
 
-std::string MonitoringJob::TimeToStr(std::time_t* t) const {
-    std::string str(std::ctime(t));
-    str.pop_back();
-    return str;
+// `time` in local time, as formatted by strftime.
+static std::string Clock(httpi::TimeSeries::time_point time,
+                         const char* format) {
+    std::time_t t = std::chrono::system_clock::to_time_t(time);
+    std::tm tm;
+    localtime_r(&t, &tm);
+    char buf[64];
+    return std::string(buf, std::strftime(buf, sizeof(buf), format, &tm));
 }
 
-void MonitoringJob::Do() {
-    httpi::html::Chart ram("RAM_usage");
-    httpi::html::Chart cpu("CPU_usage");
-
-    ram.Label("time").Value("ram");
-    cpu.Label("time").Value("cpu");
-
-    size_t last_time = 0;
-    while (running_) {
-        auto begin = std::chrono::system_clock::now();
-
-        Stats s = GetMonitoringStats();
-
-        ram.Log("ram", s.vsize);
-        cpu.Log("cpu",
-                (100 / refresh_delay_) *
-                    ((double)s.utime + s.stime - last_time) /
-                    sysconf(_SC_CLK_TCK));
+typedef std::vector<
+    std::pair<std::string, std::vector<httpi::TimeSeries::Point>>>
+    ChartSeries;
+
+// A chart of the means of `series`, sampled together, or nothing before the
+// first sample.
+static std::string SeriesChart(const std::string& name,
+                               const char* format,
+                               const ChartSeries& series) {
+    if (series.empty() || series[0].second.empty()) {
+        return "";
+    }
+    Chart chart(name);
+    chart.Label("time");
+    for (auto& p : series[0].second) {
+        chart.Log("time", Clock(p.time, format));
+    }
+    for (auto& s : series) {
+        chart.Value(s.first);
+        for (auto& p : s.second) {
+            chart.Log(s.first, p.mean);
+        }
+    }
+    return chart.Get();
+}
 
-        auto t = std::chrono::system_clock::to_time_t(begin);
-        ram.Log("time", TimeToStr(&t));
-        cpu.Log("time", TimeToStr(&t));
-        ram.MostRecent(history_size_);
-        cpu.MostRecent(history_size_);
+// A row of the table of rates, updated by the LiveScript.
+static Html StatRow(const std::string& name,
+                    const std::string& stat,
+                    uint64_t value) {
+    return Html() << Tr() << Td() << name << Close()
+                  << Td().Attr("data-stat", stat) << std::to_string(value)
+                  << Close() << Close();
+}
 
-        last_time = s.utime + s.stime;
+httpi::html::Html MonitoringJob::RenderPage(const Progress&) const {
+    auto now = std::chrono::system_clock::now();
+    auto day = now - std::chrono::hours(24);
+    auto week = now - std::chrono::hours(24 * 7);
+    std::shared_ptr<const Rates> r = rates_.Load();
+
+    // clang-format off
+    return Html() <<
+        SeriesChart("RAM_usage", "%H:%M:%S",
+                    {{"ram", ram_.Last(0, history_size_)}}) <<
+        SeriesChart("CPU_usage", "%H:%M:%S",
+                    {{"cpu", cpu_.Last(0, history_size_)}}) <<
+        SeriesChart("IO", "%H:%M:%S",
+                    {{"read", read_.Last(0, history_size_)},
+                     {"write", write_.Last(0, history_size_)}}) <<
+        Table().AddClass("table") <<
+            StatRow("Threads", "threads", r->threads) <<
+            StatRow("Virtual size", "vsize", r->vsize) <<
+            StatRow("Context switches/s", "switches", r->switches) <<
+            StatRow("Page faults/s", "faults", r->faults) <<
+            StatRow("Major page faults/s", "major_faults", r->major_faults) <<
+        Close() <<
+        SeriesChart("RAM_last_day", "%H:%M",
+                    {{"ram", ram_.Query(1, day, now)}}) <<
+        SeriesChart("CPU_last_day", "%H:%M",
+                    {{"cpu", cpu_.Query(1, day, now)}}) <<
+        SeriesChart("RAM_last_week", "%a %Hh",
+                    {{"ram", ram_.Query(2, week, now)}}) <<
+        SeriesChart("CPU_last_week", "%a %Hh",
+                    {{"cpu", cpu_.Query(2, week, now)}});
+    // clang-format on
+}
 
-        SetPage(Html() << ram.Get() << cpu.Get());
+void MonitoringJob::Do() {
+    const double ticks_per_second = sysconf(_SC_CLK_TCK);
+    httpi::ProcSampler sampler;
+    httpi::ProcStats last;
+    if (!sampler.Sample(&last)) {
+        SetStatus("Cannot read /proc/self/stat");
+        return;
+    }
+    sampler.SampleCounters(&last);
+    auto last_time = std::chrono::steady_clock::now();
+    // The context switches and I/O, slower to read, are sampled once a
+    // second against a sample of their own.
+    httpi::ProcStats last_counters = last;
+    auto last_counters_time = last_time;
+    double read = 0;
+    double write = 0;
+    uint64_t samples = 0;
+
+    // Cut short when cancelled.
+    while (cancel_token()->SleepFor(refresh_delay_ -
+                                    (std::chrono::steady_clock::now() -
+                                     last_time))) {
+        httpi::ProcStats s;
+        if (!sampler.Sample(&s)) {
+            SetStatus("Cannot read /proc/self/stat");
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        auto per_second = [now](uint64_t after,
+                                uint64_t before,
+                                std::chrono::steady_clock::time_point since) {
+            double seconds = std::max(
+                1e-3, std::chrono::duration<double>(now - since).count());
+            return (after - before) / seconds;
+        };
+        auto rounded = [](double x) { return static_cast<uint64_t>(x + 0.5); };
+
+        double cpu_usage = 100 *
+                           per_second(s.utime + s.stime,
+                                      last.utime + last.stime,
+                                      last_time) /
+                           ticks_per_second;
+        auto rates = std::make_shared<Rates>(*rates_.Load());
+        rates->threads = s.threads;
+        rates->vsize = s.vsize_bytes;
+        rates->faults =
+            rounded(per_second(s.minor_faults + s.major_faults,
+                               last.minor_faults + last.major_faults,
+                               last_time));
+        rates->major_faults =
+            rounded(per_second(s.major_faults, last.major_faults, last_time));
+        bool counters = now - last_counters_time >= std::chrono::seconds(1);
+        if (counters) {
+            sampler.SampleCounters(&s);
+            read = per_second(
+                s.read_bytes, last_counters.read_bytes, last_counters_time);
+            write = per_second(
+                s.write_bytes, last_counters.write_bytes, last_counters_time);
+            rates->switches = rounded(per_second(
+                s.voluntary_switches + s.involuntary_switches,
+                last_counters.voluntary_switches +
+                    last_counters.involuntary_switches,
+                last_counters_time));
+            last_counters = s;
+            last_counters_time = now;
+        }
 
-        std::this_thread::sleep_for(std::chrono::seconds(refresh_delay_) -
-                                    (std::chrono::system_clock::now() - begin));
+        auto time = std::chrono::system_clock::now();
+        ram_.Add(time, s.rss_bytes);
+        cpu_.Add(time, cpu_usage);
+        if (counters) {
+            read_.Add(time, read);
+            write_.Add(time, write);
+        }
+        rates_.Store(rates);
+        // The page is rendered again from the series when asked for.
+        SetProgress(++samples);
+
+        // The live charts show the same 1 s buckets as the page: each event
+        // carries the means of the newest ones, which replace the last
+        // point of a chart until the next second starts.
+        auto bucket = [](const httpi::TimeSeries& series) {
+            return series.Last(0, 1).back();
+        };
+        httpi::TimeSeries::Point ram = bucket(ram_);
+        std::string io;
+        if (!read_.Last(0, 1).empty()) {
+            httpi::TimeSeries::Point r = bucket(read_);
+            io = ", \"io_time\": \"" + Clock(r.time, "%H:%M:%S") +
+                 "\", \"read\": " + std::to_string(r.mean) +
+                 ", \"write\": " + std::to_string(bucket(write_).mean);
+        }
+        events().Publish(
+            "sample",
+            "{\"time\": \"" + Clock(ram.time, "%H:%M:%S") + "\", \"ram\": " +
+                std::to_string(ram.mean) + ", \"cpu\": " +
+                std::to_string(bucket(cpu_).mean) + io + ", \"threads\": " +
+                std::to_string(rates->threads) + ", \"vsize\": " +
+                std::to_string(rates->vsize) + ", \"switches\": " +
+                std::to_string(rates->switches) + ", \"faults\": " +
+                std::to_string(rates->faults) + ", \"major_faults\": " +
+                std::to_string(rates->major_faults) + "}");
+
+        last = s;
+        last_time = now;
     }
     std::cout << "Stop monitoring\n";
 }
@@ -1,33 +1,52 @@
 #pragma once
 
-#include <ctime>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 
 #include "html/html.h"
+#include "snapshot.h"
+#include "time-series.h"
 #include "webjob.h"
 
+// Samples the resource usage of the process every `refresh_delay`, and
+// charts the last `history_size` seconds live, the last day by the minute
+// and the last week by the hour. Sampling is cheap enough for a delay of
+// 100 ms, see httpi::ProcSampler; the context switches and I/O, costlier,
+// are only sampled once a second.
 class MonitoringJob : public WebJob {
-    struct Stats {
-        size_t utime = 0;
-        size_t stime = 0;
-        size_t vsize = 0;
+    // The latest rates, for the table.
+    struct Rates {
+        uint64_t threads = 0;
+        uint64_t vsize = 0;
+        uint64_t switches = 0;
+        uint64_t faults = 0;
+        uint64_t major_faults = 0;
     };
 
-    Stats GetMonitoringStats() const;
-    std::string TimeToStr(std::time_t* t) const;
-    std::atomic<bool> running_;
-    const int refresh_delay_;
+    const std::chrono::milliseconds refresh_delay_;
     const int history_size_;
+    // Kept as numbers, at a fixed size whatever the sampling rate: see
+    // httpi::TimeSeries.
+    httpi::TimeSeries ram_;
+    httpi::TimeSeries cpu_;
+    httpi::TimeSeries read_;
+    httpi::TimeSeries write_;
+    httpi::AtomicSnapshot<Rates> rates_{std::make_shared<const Rates>()};
 
    public:
-    MonitoringJob(int refresh_delay, int history_size)
-        : running_(true),
-          refresh_delay_(refresh_delay),
-          history_size_(history_size) {}
-
-    void Stop() override { running_ = false; }
+    MonitoringJob(std::chrono::milliseconds refresh_delay, int history_size)
+        : refresh_delay_(refresh_delay), history_size_(history_size) {}
 
     void Do() override;
     std::string name() const override { return "Monitoring"; }
+
+    // The charts and the table of rates, as of the latest sample.
+    httpi::html::Html RenderPage(const Progress& p) const override;
+
+    // Adds each new sample, sent as a "sample" event, to the live charts and
+    // the table of rates. The charts keep one point per second, like the
+    // page's.
+    std::string LiveScript(const std::string& events_url) const override;
 };
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "webjob.h"
+
+// A job whose work splits into independent chunks, run in parallel on the
+// threads of `jp`.
+//
+// The job's thread and up to `parallelism - 1` tasks submitted to `jp` each
+// claim the next chunk not started, until there are none: threads done early
+// take more chunks, and the Executor lets idle threads steal the tasks
+// queued behind a busy one. When the pool is busy, fewer tasks start, down
+// to the job's thread running every chunk itself. Chunks should be many more
+// than the threads, so that they balance.
+class ParallelWebJob : public WebJob {
+    // With the tasks, which can outlive the job: those starting once every
+    // chunk is claimed return without touching it.
+    struct Shared {
+        ParallelWebJob* job;
+        size_t chunks;
+        std::atomic<size_t> next{0};
+        std::mutex guard;
+        std::condition_variable finished;
+        size_t done = 0;
+        // The first exception a chunk threw: the chunks not started after it
+        // are skipped.
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+
+        void Drain() {
+            size_t chunk;
+            while ((chunk = next.fetch_add(1, std::memory_order_relaxed)) <
+                   chunks) {
+                std::exception_ptr e;
+                if (!job->cancelled() &&
+                    !failed.load(std::memory_order_relaxed)) {
+                    try {
+                        job->RunChunk(chunk);
+                    } catch (...) {
+                        e = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lk(guard);
+                if (e && !error) {
+                    error = e;
+                    failed.store(true, std::memory_order_relaxed);
+                }
+                if (++done == chunks) {
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+
+    WebJobsPool& jp_;
+    const httpi::Priority priority_;
+    const unsigned parallelism_;
+
+   public:
+    // `jp` runs the job and its chunks: it must outlive the job. A
+    // `parallelism` of 0 uses every thread of `jp`.
+    explicit ParallelWebJob(WebJobsPool& jp,
+                            httpi::Priority priority = httpi::Priority::kNormal,
+                            unsigned parallelism = 0)
+        : jp_(jp),
+          priority_(priority),
+          parallelism_(parallelism ? parallelism : jp.max_concurrency()) {}
+
+    void Do() final {
+        auto shared = std::make_shared<Shared>();
+        shared->job = this;
+        shared->chunks = Split();
+
+        size_t helpers =
+            std::min<size_t>(parallelism_, shared->chunks) -
+            std::min<size_t>(1, shared->chunks);
+        for (size_t i = 0; i < helpers; ++i) {
+            jp_.Submit([shared]() { shared->Drain(); }, priority_);
+        }
+        shared->Drain();
+        {
+            std::unique_lock<std::mutex> lk(shared->guard);
+            shared->finished.wait(
+                lk, [&shared]() { return shared->done == shared->chunks; });
+        }
+        if (shared->error) {
+            std::rethrow_exception(shared->error);
+        }
+        Merge();
+    }
+
+   protected:
+    // Prepares the work, and returns how many chunks it splits into. Called
+    // first, on the job's thread.
+    virtual size_t Split() = 0;
+
+    // Runs one chunk, on any of the pool's threads, concurrently with others.
+    // Chunks not started once the job is cancelled are skipped; long ones
+    // poll cancelled(). Progress goes through AddProgress().
+    virtual void RunChunk(size_t chunk) = 0;
+
+    // Called last, on the job's thread, once every chunk ran or was skipped;
+    // not if one threw, whose exception Do() throws again once the chunks
+    // running are done.
+    virtual void Merge() {}
+};
@@ -0,0 +1,138 @@
+#include "proc-sampler.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+
+namespace httpi {
+
+// Parses the number at `p`, leaving `p` past it.
+static uint64_t ParseNumber(const char*& p, const char* end) {
+    uint64_t n = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        n = n * 10 + (*p++ - '0');
+    }
+    return n;
+}
+
+// Skips `fields` space separated fields from `p`.
+static void SkipFields(const char*& p, const char* end, int fields) {
+    while (fields > 0 && p < end) {
+        while (p < end && *p != ' ') {
+            ++p;
+        }
+        while (p < end && *p == ' ') {
+            ++p;
+        }
+        --fields;
+    }
+}
+
+// The number after `key`, found at the start of a line of `buf`, or 0.
+static uint64_t FindField(const char* buf, const char* end, const char* key) {
+    size_t size = std::strlen(key);
+    for (const char* line = buf; line < end;) {
+        if (static_cast<size_t>(end - line) > size &&
+            std::memcmp(line, key, size) == 0) {
+            const char* p = line + size;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                ++p;
+            }
+            return ParseNumber(p, end);
+        }
+        const char* next =
+            static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (!next) {
+            break;
+        }
+        line = next + 1;
+    }
+    return 0;
+}
+
+static int OpenProc(const char* path) {
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+ProcSampler::ProcSampler()
+    : stat_fd_(OpenProc("/proc/self/stat")),
+      io_fd_(OpenProc("/proc/self/io")),
+      page_size_(sysconf(_SC_PAGESIZE)) {}
+
+ProcSampler::~ProcSampler() {
+    for (int fd : {stat_fd_, io_fd_}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+long ProcSampler::Read(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t size;
+    do {
+        size = pread(fd, buf_, sizeof(buf_), 0);
+    } while (size < 0 && errno == EINTR);
+    return size;
+}
+
+bool ProcSampler::Sample(ProcStats* out) {
+    *out = ProcStats();
+
+    long size = Read(stat_fd_);
+    if (size <= 0) {
+        return false;
+    }
+    // The command name, second, is in parentheses and may hold spaces or
+    // parentheses of its own: the fields are counted from after its last
+    // closing one, starting with the state, third.
+    const char* end = buf_ + size;
+    const char* p = buf_ + size;
+    while (p > buf_ && p[-1] != ')') {
+        --p;
+    }
+    if (p == buf_) {
+        return false;
+    }
+    SkipFields(p, end, 8);  // To minflt, 10th.
+    out->minor_faults = ParseNumber(p, end);
+    SkipFields(p, end, 2);  // To majflt, 12th.
+    out->major_faults = ParseNumber(p, end);
+    SkipFields(p, end, 2);  // To utime, 14th.
+    out->utime = ParseNumber(p, end);
+    SkipFields(p, end, 1);
+    out->stime = ParseNumber(p, end);
+    SkipFields(p, end, 5);  // To num_threads, 20th.
+    out->threads = ParseNumber(p, end);
+    SkipFields(p, end, 3);  // To vsize, 23rd.
+    out->vsize_bytes = ParseNumber(p, end);
+    SkipFields(p, end, 1);
+    out->rss_bytes = ParseNumber(p, end) * page_size_;
+    return true;
+}
+
+void ProcSampler::SampleCounters(ProcStats* out) {
+    // Those in /proc/self/status are the main thread's only.
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        out->voluntary_switches = usage.ru_nvcsw;
+        out->involuntary_switches = usage.ru_nivcsw;
+    }
+
+    long size = Read(io_fd_);
+    if (size > 0) {
+        const char* end = buf_ + size;
+        out->read_bytes = FindField(buf_, end, "rchar:");
+        out->write_bytes = FindField(buf_, end, "wchar:");
+        out->disk_read_bytes = FindField(buf_, end, "read_bytes:");
+        out->disk_write_bytes = FindField(buf_, end, "write_bytes:");
+    }
+}
+
+}  // httpi
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace httpi {
+
+// The resource usage of the process, as counted by the kernel since it
+// started; rates come from the difference between two samples.
+struct ProcStats {
+    // In clock ticks, sysconf(_SC_CLK_TCK) per second.
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    uint64_t vsize_bytes = 0;
+    uint64_t rss_bytes = 0;
+    uint64_t threads = 0;
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+    // Only filled by ProcSampler::SampleCounters().
+    uint64_t voluntary_switches = 0;
+    uint64_t involuntary_switches = 0;
+    // Through read() and write() like calls, sockets included.
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    // What reached the storage.
+    uint64_t disk_read_bytes = 0;
+    uint64_t disk_write_bytes = 0;
+};
+
+// Samples /proc/self cheaply enough to do it many times a second: the files
+// stay open, and a sample is a pread() into a fixed buffer parsed in place,
+// without allocating. Sample() only reads /proc/self/stat, in about a third
+// of the time an ifstream takes. SampleCounters() adds a getrusage() for the
+// context switches and a read of /proc/self/io, which together cost more
+// than half as much again, so they are better sampled less often.
+class ProcSampler {
+   public:
+    // Files which cannot be opened, like /proc/self/io in some containers,
+    // leave their fields at 0.
+    ProcSampler();
+    ~ProcSampler();
+
+    ProcSampler(const ProcSampler&) = delete;
+    ProcSampler& operator=(const ProcSampler&) = delete;
+
+    // Resets `out` to the fields of /proc/self/stat. Returns false if it
+    // cannot be read. Not thread safe.
+    bool Sample(ProcStats* out);
+    // Sets the context switches and I/O fields of `out`, leaving the others.
+    // Not thread safe.
+    void SampleCounters(ProcStats* out);
+
+   private:
+    // Reads `fd` into `buf_`, returning the size read or -1.
+    long Read(int fd);
+
+    int stat_fd_;
+    int io_fd_;
+    const long page_size_;
+    char buf_[4096];
+};
+
+}  // httpi
@@ -0,0 +1,75 @@
+#include "proc-sampler.h"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main() {
+    httpi::ProcSampler sampler;
+    httpi::ProcStats before;
+    assert(sampler.Sample(&before));
+    sampler.SampleCounters(&before);
+    assert(before.threads >= 1);
+    assert(before.vsize_bytes > 0 && before.rss_bytes > 0);
+    assert(before.rss_bytes <= before.vsize_bytes);
+
+    // Touching memory faults pages in and grows the RSS.
+    std::vector<char> memory(64 << 20);
+    for (size_t i = 0; i < memory.size(); i += 4096) {
+        memory[i] = 1;
+    }
+    // Reading and blocking are counted.
+    {
+        std::ifstream f("/proc/self/maps");
+        std::string line;
+        while (std::getline(f, line)) {
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::mutex m;
+    std::condition_variable cv;
+    bool sampled = false;
+    std::thread other([&]() {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&]() { return sampled; });
+    });
+
+    httpi::ProcStats after;
+    assert(sampler.Sample(&after));
+    sampler.SampleCounters(&after);
+    {
+        std::lock_guard<std::mutex> lk(m);
+        sampled = true;
+    }
+    cv.notify_all();
+    other.join();
+
+    assert(after.threads == before.threads + 1);
+    assert(after.rss_bytes >= before.rss_bytes + (32 << 20));
+    assert(after.minor_faults > before.minor_faults);
+    assert(after.voluntary_switches > before.voluntary_switches);
+    assert(after.read_bytes == 0 || after.read_bytes > before.read_bytes);
+    assert(after.utime + after.stime >= before.utime + before.stime);
+
+    // The same as reading the fields the slow way.
+    std::ifstream stat("/proc/self/stat");
+    std::string field;
+    std::vector<std::string> fields;
+    while (stat >> field) {
+        fields.push_back(field);
+    }
+    httpi::ProcStats now;
+    assert(sampler.Sample(&now));
+    assert(std::to_string(now.vsize_bytes) == fields[22]);
+    assert(std::to_string(now.threads) == fields[19]);
+
+    std::cout << "OK\n";
+    return 0;
+}
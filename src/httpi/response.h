@@ -0,0 +1,139 @@
+#pragma once
+
+#include <boost/container/small_vector.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace httpi {
+
+// What a handler sends back. The body is a list of refcounted immutable
+// buffers which the server hands to the network as they are, so a page that
+// is already held in a shared_ptr (like WebJob::page()) is never copied. The
+// references are released once the response has been sent.
+//
+// Parts of the body can also be streamed: a Producer is called while the
+// response is being sent, so the first bytes leave before the rest of the page
+// even exists, and the page is never held in memory as a whole. A response
+// with a streamed part is sent with chunked transfer encoding.
+//
+// Parts fed by events rather than by work, like Server-Sent Events, use a
+// Puller instead: it never blocks, and the connection holds no thread while
+// it waits for more.
+//
+// Converts implicitly from a std::string, so handlers returning a plain string
+// keep working; that string is moved into the response, not copied.
+class Response {
+   public:
+    typedef std::shared_ptr<const std::string> Buffer;
+
+    // Appends the next chunk of the body to `out` and returns whether there is
+    // more to come. Called from a server thread, one call per chunk, for as
+    // long as it returns true. It may block while the next chunk is produced,
+    // which holds that server thread.
+    typedef std::function<bool(std::string* out)> Producer;
+
+    enum class Pulled { kMore, kWait, kEnd };
+    // Appends what is available to `out` and returns kMore, or kEnd if that
+    // was the last of it. When nothing is available yet, returns kWait after
+    // arranging for `wake` to be called, from any thread, once there is: the
+    // connection is suspended until then (or, for a server with a thread per
+    // connection, its thread waits).
+    typedef std::function<Pulled(std::string* out,
+                                 const std::function<void()>& wake)>
+        Puller;
+
+    // Either a buffer, a producer or a puller.
+    struct Part {
+        Buffer buffer;
+        Producer producer;
+        Puller puller;
+    };
+    // Most pages are a layout around some content: keep that many parts inline
+    // rather than allocating for each response.
+    typedef boost::container::small_vector<Part, 4> Parts;
+
+    Response() = default;
+    Response(std::string body) {
+        Append(std::make_shared<const std::string>(std::move(body)));
+    }
+    Response(const char* body) : Response(std::string(body)) {}
+    Response(Buffer body) { Append(std::move(body)); }
+
+    Response& Append(Buffer buf) {
+        size_ += buf->size();
+        body_.push_back(Part{std::move(buf), nullptr, nullptr});
+        return *this;
+    }
+    Response& Append(std::string str) {
+        return Append(std::make_shared<const std::string>(std::move(str)));
+    }
+    Response& Append(const char* str) { return Append(std::string(str)); }
+    // Appends the body of `r`, leaving its status, headers and ETag behind.
+    Response& Append(Response r) {
+        for (auto& p : r.body_) {
+            body_.push_back(std::move(p));
+        }
+        size_ += r.size_;
+        streamed_ = streamed_ || r.streamed_;
+        pulled_ = pulled_ || r.pulled_;
+        return *this;
+    }
+
+    Response& Stream(Producer producer) {
+        streamed_ = true;
+        body_.push_back(Part{nullptr, std::move(producer), nullptr});
+        return *this;
+    }
+
+    Response& Pull(Puller puller) {
+        streamed_ = true;
+        pulled_ = true;
+        body_.push_back(Part{nullptr, nullptr, std::move(puller)});
+        return *this;
+    }
+
+    Response& Status(int code) {
+        status_ = code;
+        return *this;
+    }
+
+    Response& Header(std::string name, std::string value) {
+        headers_.emplace_back(std::move(name), std::move(value));
+        return *this;
+    }
+
+    // Identifies this version of the body, quotes included. When a client
+    // sends it back in If-None-Match, the server answers 304 without a body.
+    Response& ETag(std::string etag) {
+        etag_ = std::move(etag);
+        return *this;
+    }
+
+    int status() const { return status_; }
+    const std::string& etag() const { return etag_; }
+    const Parts& body() const { return body_; }
+    const std::vector<std::pair<std::string, std::string>>& headers() const {
+        return headers_;
+    }
+
+    // Whether some part of the body is produced while sending. If so, size()
+    // only counts the buffered parts.
+    bool streamed() const { return streamed_; }
+    // Whether some part of the body is pulled, and may wait for events.
+    bool pulled() const { return pulled_; }
+    size_t size() const { return size_; }
+
+   private:
+    int status_ = 200;
+    size_t size_ = 0;
+    bool streamed_ = false;
+    bool pulled_ = false;
+    std::string etag_;
+    Parts body_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+};
+
+}  // httpi
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <boost/utility/string_ref.hpp>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace httpi {
+
+// A parameter captured while routing. Neither field owns its memory: the name
+// points into the route table and the value into the request url, both alive
+// for the duration of the handler call.
+struct PathParam {
+    boost::string_ref name;
+    boost::string_ref value;
+};
+
+// The parameters captured by a route, in pattern order. Fixed capacity, so
+// routing a request never allocates.
+class PathParams {
+   public:
+    static constexpr size_t kMaxParams = 8;
+
+    // Returns an empty string_ref if the route has no such parameter.
+    boost::string_ref Get(boost::string_ref name) const {
+        for (size_t i = 0; i < size_; ++i) {
+            if (params_[i].name == name) {
+                return params_[i].value;
+            }
+        }
+        return boost::string_ref();
+    }
+
+    bool Has(boost::string_ref name) const {
+        for (size_t i = 0; i < size_; ++i) {
+            if (params_[i].name == name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const PathParam* begin() const { return params_.data(); }
+    const PathParam* end() const { return params_.data() + size_; }
+
+    bool Push(boost::string_ref name, boost::string_ref value) {
+        if (size_ == kMaxParams) {
+            return false;
+        }
+        params_[size_++] = PathParam{name, value};
+        return true;
+    }
+    void Pop() { --size_; }
+    void Clear() { size_ = 0; }
+
+   private:
+    std::array<PathParam, kMaxParams> params_;
+    size_t size_ = 0;
+};
+
+// A radix tree mapping url patterns to values.
+//
+// Patterns are made of static text, `:name` segments matching one non empty
+// path segment, and an optional trailing `*name` matching the rest of the
+// path, possibly empty:
+//
+//   /jobs            only /jobs
+//   /jobs/:id        /jobs/42, but neither /jobs/ nor /jobs/42/log
+//   /static/*file    /static/, /static/css/main.css
+//
+// When several patterns match, static text wins over a parameter, which wins
+// over a wildcard. A lookup walks the url once, comparing each byte at most a
+// few times, and records parameters without allocating.
+template <class Value>
+class Router {
+   public:
+    struct Entry {
+        std::string pattern;
+        Value value;
+    };
+
+    Router() : root_(new Node) {}
+    Router(const Router& r) : root_(new Node(*r.root_)), size_(r.size_) {}
+    Router& operator=(const Router& r) {
+        root_.reset(new Node(*r.root_));
+        size_ = r.size_;
+        return *this;
+    }
+    Router(Router&&) = default;
+    Router& operator=(Router&&) = default;
+
+    // Whether Insert() would succeed. Follows the nodes the pattern goes
+    // through as far as they exist; past them, only its syntax is checked.
+    bool CanInsert(boost::string_ref pat) const {
+        const Node* n = root_.get();
+        while (!pat.empty()) {
+            if (pat[0] == ':') {
+                size_t len = std::min(pat.find('/'), pat.size());
+                boost::string_ref name = pat.substr(1, len - 1);
+                if (name.empty() || name.find_first_of(":*") != name.npos) {
+                    return false;
+                }
+                if (n && n->param && n->param_name != name) {
+                    return false;
+                }
+                n = n ? n->param.get() : nullptr;
+                pat.remove_prefix(len);
+            } else if (pat[0] == '*') {
+                boost::string_ref name = pat.substr(1);
+                if (name.empty() || name.find('/') != name.npos) {
+                    return false;
+                }
+                if (n && n->wildcard && n->wildcard_name != name) {
+                    return false;
+                }
+                n = n ? n->wildcard.get() : nullptr;
+                pat.clear();
+            } else {
+                size_t run = std::min(pat.find_first_of(":*"), pat.size());
+                boost::string_ref text = pat.substr(0, run);
+                // Text ending within a node's prefix gets a node of its own.
+                while (n && !text.empty()) {
+                    n = n->StaticChild(text[0]);
+                    if (n && text.starts_with(n->prefix)) {
+                        text.remove_prefix(n->prefix.size());
+                    } else {
+                        n = nullptr;
+                    }
+                }
+                pat.remove_prefix(run);
+            }
+        }
+        return !(n && n->entry);
+    }
+
+    // Returns false if the pattern is already registered, malformed, or uses a
+    // different name for a parameter than an already registered pattern at the
+    // same position. The router is left unchanged then.
+    bool Insert(const std::string& pattern, Value v) {
+        if (!CanInsert(pattern)) {
+            return false;
+        }
+        Node* n = root_.get();
+        boost::string_ref pat(pattern);
+
+        while (!pat.empty()) {
+            if (pat[0] == ':') {
+                size_t len = std::min(pat.find('/'), pat.size());
+                if (!n->param) {
+                    n->param.reset(new Node);
+                    n->param_name = pat.substr(1, len - 1).to_string();
+                }
+                n = n->param.get();
+                pat.remove_prefix(len);
+            } else if (pat[0] == '*') {
+                if (!n->wildcard) {
+                    n->wildcard.reset(new Node);
+                    n->wildcard_name = pat.substr(1).to_string();
+                }
+                n = n->wildcard.get();
+                pat.clear();
+            } else {
+                size_t run = std::min(pat.find_first_of(":*"), pat.size());
+                boost::string_ref text = pat.substr(0, run);
+                Node* child = n->StaticChild(text[0]);
+                if (!child) {
+                    n->AddStatic(text.to_string());
+                    n = n->statics.back().get();
+                    pat.remove_prefix(run);
+                    continue;
+                }
+
+                size_t common = 0;
+                while (common < text.size() &&
+                       common < child->prefix.size() &&
+                       text[common] == child->prefix[common]) {
+                    ++common;
+                }
+                if (common < child->prefix.size()) {
+                    child->Split(common);
+                }
+                n = child;
+                pat.remove_prefix(common);
+            }
+        }
+
+        n->entry.reset(new Entry{pattern, std::move(v)});
+        ++size_;
+        return true;
+    }
+
+    // Removes the exact pattern given at registration. Returns false if it was
+    // not registered.
+    bool Erase(const std::string& pattern) {
+        std::vector<const Entry*> entries;
+        root_->Collect(&entries);
+
+        Router pruned;
+        bool found = false;
+        for (auto e : entries) {
+            if (e->pattern == pattern) {
+                found = true;
+            } else {
+                pruned.Insert(e->pattern, e->value);
+            }
+        }
+        if (found) {
+            *this = std::move(pruned);
+        }
+        return found;
+    }
+
+    // Returns nullptr if no pattern matches `path`. On success, `params` holds
+    // the captured parameters, which point into `path` and into this router.
+    const Entry* Find(boost::string_ref path, PathParams* params) const {
+        params->Clear();
+        return Match(*root_, path, params);
+    }
+
+    size_t size() const { return size_; }
+
+    template <class F>
+    void foreach_route(F&& f) const {
+        std::vector<const Entry*> entries;
+        root_->Collect(&entries);
+        for (auto e : entries) {
+            f(*e);
+        }
+    }
+
+   private:
+    struct Node {
+        // Static text matched to reach this node from its parent. Empty for the
+        // root and for parameter and wildcard nodes.
+        std::string prefix;
+
+        // First byte of each static child's prefix, in the same order as
+        // `statics`, so that picking a child is a single memchr.
+        std::string indices;
+        std::vector<std::unique_ptr<Node>> statics;
+
+        std::string param_name;
+        std::unique_ptr<Node> param;
+
+        std::string wildcard_name;
+        std::unique_ptr<Node> wildcard;
+
+        std::unique_ptr<Entry> entry;
+
+        Node() = default;
+        Node(const Node& n)
+            : prefix(n.prefix),
+              indices(n.indices),
+              param_name(n.param_name),
+              param(n.param ? new Node(*n.param) : nullptr),
+              wildcard_name(n.wildcard_name),
+              wildcard(n.wildcard ? new Node(*n.wildcard) : nullptr),
+              entry(n.entry ? new Entry(*n.entry) : nullptr) {
+            statics.reserve(n.statics.size());
+            for (auto& c : n.statics) {
+                statics.emplace_back(new Node(*c));
+            }
+        }
+
+        Node* StaticChild(char c) const {
+            auto pos = indices.find(c);
+            return pos == std::string::npos ? nullptr : statics[pos].get();
+        }
+
+        void AddStatic(std::string text) {
+            indices.push_back(text[0]);
+            statics.emplace_back(new Node);
+            statics.back()->prefix = std::move(text);
+        }
+
+        // Cuts this node's prefix at `at`: the node keeps the head and a new
+        // single child takes the tail along with everything below.
+        void Split(size_t at) {
+            std::unique_ptr<Node> tail(new Node);
+            tail->prefix = prefix.substr(at);
+            tail->indices = std::move(indices);
+            tail->statics = std::move(statics);
+            tail->param_name = std::move(param_name);
+            tail->param = std::move(param);
+            tail->wildcard_name = std::move(wildcard_name);
+            tail->wildcard = std::move(wildcard);
+            tail->entry = std::move(entry);
+
+            prefix.resize(at);
+            indices.assign(1, tail->prefix[0]);
+            statics.clear();
+            statics.push_back(std::move(tail));
+            param_name.clear();
+            wildcard_name.clear();
+        }
+
+        void Collect(std::vector<const Entry*>* out) const {
+            if (entry) {
+                out->push_back(entry.get());
+            }
+            for (auto& c : statics) {
+                c->Collect(out);
+            }
+            if (param) {
+                param->Collect(out);
+            }
+            if (wildcard) {
+                wildcard->Collect(out);
+            }
+        }
+    };
+
+    static const Entry* Match(const Node& n,
+                              boost::string_ref path,
+                              PathParams* params) {
+        if (path.empty() && n.entry) {
+            return n.entry.get();
+        }
+
+        if (!path.empty()) {
+            const Node* child = n.StaticChild(path[0]);
+            if (child && path.starts_with(child->prefix)) {
+                const Entry* e =
+                    Match(*child, path.substr(child->prefix.size()), params);
+                if (e) {
+                    return e;
+                }
+            }
+        }
+
+        if (n.param) {
+            size_t len = std::min(path.find('/'), path.size());
+            if (len > 0 && params->Push(n.param_name, path.substr(0, len))) {
+                const Entry* e = Match(*n.param, path.substr(len), params);
+                if (e) {
+                    return e;
+                }
+                params->Pop();
+            }
+        }
+
+        if (n.wildcard && n.wildcard->entry &&
+            params->Push(n.wildcard_name, path)) {
+            return n.wildcard->entry.get();
+        }
+
+        return nullptr;
+    }
+
+    std::unique_ptr<Node> root_;
+    size_t size_ = 0;
+};
+
+}  // httpi
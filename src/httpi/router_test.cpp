@@ -0,0 +1,68 @@
+#include "router.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+int main() {
+    httpi::Router<int> r;
+    httpi::PathParams params;
+
+    assert(r.Insert("/", 0));
+    assert(r.Insert("/jobs", 1));
+    assert(r.Insert("/jobs/:id", 2));
+    assert(r.Insert("/jobs/:id/log", 3));
+    assert(r.Insert("/jobs/cancel", 4));
+    assert(r.Insert("/jobsearch", 5));
+    assert(r.Insert("/static/*file", 6));
+    assert(!r.Insert("/jobs", 7));
+    assert(!r.Insert("/jobs/:name/page", 8));
+    assert(r.size() == 7);
+
+    auto find = [&](const char* url) {
+        auto e = r.Find(url, &params);
+        return e ? e->value : -1;
+    };
+
+    assert(find("/") == 0);
+    assert(find("/jobs") == 1);
+    assert(find("/jobsearch") == 5);
+    assert(find("/jobs/cancel") == 4);
+    assert(find("/jobs/42") == 2);
+    assert(params.Get("id") == "42");
+    assert(find("/jobs/42/log") == 3);
+    assert(params.size() == 1 && params.Get("id") == "42");
+    assert(find("/jobs/cancel/log") == 3);
+    assert(params.Get("id") == "cancel");
+    assert(find("/jobs/") == -1);
+    assert(find("/jobs/42/") == -1);
+    assert(find("/job") == -1);
+    assert(find("/static/css/main.css") == 6);
+    assert(params.Get("file") == "css/main.css");
+    assert(find("/static/") == 6);
+    assert(params.Get("file").empty() && params.Has("file"));
+
+    assert(r.Erase("/jobs/:id"));
+    assert(!r.Erase("/jobs/:id"));
+    assert(find("/jobs/42") == -1);
+    assert(find("/jobs/42/log") == 3);
+    assert(r.size() == 6);
+
+    // A rejected pattern leaves nothing behind.
+    assert(!r.Insert("/a/:id/*", 10));
+    assert(!r.Insert("/a/:id/:", 10));
+    assert(!r.Insert("/jobs/:name/*rest", 10));
+    assert(r.Insert("/a/:other", 10));
+    assert(find("/a/1") == 10 && params.Get("other") == "1");
+    assert(r.Insert("/jobs/:id/*rest", 11));
+    assert(r.Erase("/a/:other") && r.Erase("/jobs/:id/*rest"));
+    assert(r.size() == 6);
+
+    httpi::Router<int> copy(r);
+    assert(copy.Insert("/jobs/:id", 9));
+    assert(find("/jobs/42") == -1);
+    assert(copy.Find("/jobs/42", &params)->value == 9);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace httpi {
+
+// Holds an immutable value that many threads read and few threads replace.
+// Readers get a shared_ptr to the current value without taking any lock, and
+// keep using it for as long as they want: a writer never waits on them and
+// never mutates a value in place.
+//
+// The value lives in one of kSlots slots. Readers announce themselves on the
+// slot they read before copying its pointer; a writer only overwrites a slot
+// that is neither current nor announced, then flips `current_` to it. A
+// reader that raced with a flip sees `current_` move and retries.
+template <class T, size_t kSlots = 4>
+class AtomicSnapshot {
+    static_assert(kSlots >= 2, "need a spare slot to publish into");
+
+    struct Slot {
+        std::atomic<unsigned> readers{0};
+        std::shared_ptr<const T> value;
+    };
+
+    mutable std::array<Slot, kSlots> slots_;
+    std::atomic<size_t> current_{0};
+    std::mutex writers_;
+
+   public:
+    explicit AtomicSnapshot(std::shared_ptr<const T> init) {
+        slots_[0].value = std::move(init);
+    }
+
+    AtomicSnapshot(const AtomicSnapshot&) = delete;
+    AtomicSnapshot& operator=(const AtomicSnapshot&) = delete;
+
+    std::shared_ptr<const T> Load() const {
+        for (;;) {
+            size_t i = current_.load();
+            Slot& slot = slots_[i];
+            slot.readers.fetch_add(1);
+            if (current_.load() == i) {
+                std::shared_ptr<const T> value = slot.value;
+                slot.readers.fetch_sub(1);
+                return value;
+            }
+            slot.readers.fetch_sub(1);
+        }
+    }
+
+    void Store(std::shared_ptr<const T> value) {
+        std::lock_guard<std::mutex> lk(writers_);
+        Publish(std::move(value));
+    }
+
+    // Atomically replaces the value with `f(current value)`. Concurrent
+    // Update() and Store() calls are serialized, readers are not blocked.
+    template <class F>
+    void Update(F&& f) {
+        std::lock_guard<std::mutex> lk(writers_);
+        Publish(f(slots_[current_.load()].value));
+    }
+
+   private:
+    void Publish(std::shared_ptr<const T> value) {
+        size_t prev = current_.load();
+        size_t i = prev;
+        do {
+            i = (i + 1) % kSlots;
+        } while (i == prev || slots_[i].readers.load() != 0);
+
+        slots_[i].value = std::move(value);
+        current_.store(i);
+
+        // Drop the previous value now rather than when its slot gets reused,
+        // unless a reader is still copying it out.
+        if (slots_[prev].readers.load() == 0) {
+            slots_[prev].value.reset();
+        }
+    }
+};
+
+}  // httpi
@@ -0,0 +1,127 @@
+#include "time-series.h"
+
+#include <algorithm>
+
+namespace httpi {
+
+std::vector<TimeSeries::Tier> TimeSeries::DefaultTiers() {
+    return {{std::chrono::seconds(1), 3600},
+            {std::chrono::minutes(1), 24 * 60},
+            {std::chrono::hours(1), 7 * 24}};
+}
+
+TimeSeries::TimeSeries(const std::vector<Tier>& tiers) {
+    for (auto& t : tiers) {
+        tiers_.push_back(
+            Ring{t.resolution, boost::circular_buffer<Bucket>(t.capacity)});
+    }
+}
+
+void TimeSeries::Bucket::Add(double value) {
+    if (count == 0) {
+        min = max = value;
+    } else {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+    sum += value;
+    ++count;
+}
+
+int64_t TimeSeries::Ring::PeriodOf(time_point time) const {
+    int64_t s = std::chrono::duration_cast<std::chrono::seconds>(
+                    time.time_since_epoch())
+                    .count();
+    int64_t r = resolution.count();
+    // Rounded down, before the epoch too.
+    return s >= 0 ? s / r : -((-s + r - 1) / r);
+}
+
+void TimeSeries::Ring::Add(int64_t period, double value) {
+    if (buckets.capacity() == 0) {
+        return;
+    }
+    if (buckets.empty()) {
+        buckets.push_back(Bucket());
+        newest = period;
+    } else if (period > newest) {
+        // The periods without samples get empty buckets, so that a bucket's
+        // period follows from its position. A gap longer than the history
+        // only needs to empty it.
+        int64_t gap = std::min<int64_t>(period - newest, buckets.capacity());
+        for (int64_t i = 0; i < gap; ++i) {
+            buckets.push_back(Bucket());
+        }
+        newest = period;
+    } else if (period < oldest()) {
+        return;
+    }
+    buckets[buckets.size() - 1 - (newest - period)].Add(value);
+}
+
+TimeSeries::Point TimeSeries::Ring::PointAt(int64_t period) const {
+    const Bucket& b = buckets[buckets.size() - 1 - (newest - period)];
+    return Point{time_point(std::chrono::seconds(period * resolution.count())),
+                 b.min,
+                 b.max,
+                 b.sum / b.count,
+                 b.count};
+}
+
+void TimeSeries::Add(time_point time, double value) {
+    std::lock_guard<std::mutex> lk(guard_);
+    for (auto& t : tiers_) {
+        t.Add(t.PeriodOf(time), value);
+    }
+}
+
+std::vector<TimeSeries::Point> TimeSeries::Query(size_t tier,
+                                                 time_point from,
+                                                 time_point to) const {
+    std::lock_guard<std::mutex> lk(guard_);
+    const Ring& t = tiers_[tier];
+    std::vector<Point> points;
+    if (t.buckets.empty()) {
+        return points;
+    }
+    int64_t first = std::max(t.PeriodOf(from), t.oldest());
+    int64_t last = std::min(t.PeriodOf(to), t.newest);
+    for (int64_t p = first; p <= last; ++p) {
+        if (t.buckets[t.buckets.size() - 1 - (t.newest - p)].count) {
+            points.push_back(t.PointAt(p));
+        }
+    }
+    return points;
+}
+
+std::vector<TimeSeries::Point> TimeSeries::Query(time_point from,
+                                                 time_point to) const {
+    size_t tier = 0;
+    {
+        std::lock_guard<std::mutex> lk(guard_);
+        while (tier + 1 < tiers_.size()) {
+            const Ring& t = tiers_[tier];
+            // A tier not full yet holds the whole history.
+            if (!t.buckets.full() || t.oldest() <= t.PeriodOf(from)) {
+                break;
+            }
+            ++tier;
+        }
+    }
+    return Query(tier, from, to);
+}
+
+std::vector<TimeSeries::Point> TimeSeries::Last(size_t tier, size_t n) const {
+    std::lock_guard<std::mutex> lk(guard_);
+    const Ring& t = tiers_[tier];
+    std::vector<Point> points;
+    for (int64_t p = t.newest; p >= t.oldest() && points.size() < n; --p) {
+        if (t.buckets[t.buckets.size() - 1 - (t.newest - p)].count) {
+            points.push_back(t.PointAt(p));
+        }
+    }
+    std::reverse(points.begin(), points.end());
+    return points;
+}
+
+}  // httpi
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <boost/circular_buffer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace httpi {
+
+// The recent history of a numeric value, kept at several resolutions: each
+// sample goes to every tier, into the bucket of its time, which keeps the
+// min, max and sum of the samples in it. A tier is a fixed ring of buckets,
+// one per period of its resolution, the oldest overwritten as time goes by.
+//
+// With the default tiers, a week of history is about 5200 buckets of 32
+// bytes, whatever the sampling rate. Queries find their first bucket from
+// its time, and cost one step per bucket of the range.
+class TimeSeries {
+   public:
+    typedef std::chrono::system_clock::time_point time_point;
+
+    struct Tier {
+        std::chrono::seconds resolution;
+        size_t capacity;
+    };
+
+    // The samples of a bucket.
+    struct Point {
+        // The start of the bucket.
+        time_point time;
+        double min;
+        double max;
+        double mean;
+        uint32_t count;
+    };
+
+    // 1 s for an hour, 1 min for a day, and 1 h for a week.
+    static std::vector<Tier> DefaultTiers();
+
+    // From the finest resolution to the coarsest.
+    explicit TimeSeries(const std::vector<Tier>& tiers = DefaultTiers());
+
+    TimeSeries(const TimeSeries&) = delete;
+    TimeSeries& operator=(const TimeSeries&) = delete;
+
+    // Samples older than a tier's history are left out of it.
+    void Add(time_point time, double value);
+
+    // The non-empty buckets of `tier` in [from, to], oldest first.
+    std::vector<Point> Query(size_t tier, time_point from, time_point to) const;
+    // From the finest tier whose history reaches back to `from`, or else the
+    // coarsest.
+    std::vector<Point> Query(time_point from, time_point to) const;
+    // The last `n` non-empty buckets of `tier`, oldest first.
+    std::vector<Point> Last(size_t tier, size_t n) const;
+
+    size_t tiers() const { return tiers_.size(); }
+    std::chrono::seconds resolution(size_t tier) const {
+        return tiers_[tier].resolution;
+    }
+
+   private:
+    struct Bucket {
+        double sum = 0;
+        double min = 0;
+        double max = 0;
+        uint32_t count = 0;
+
+        void Add(double value);
+    };
+
+    struct Ring {
+        std::chrono::seconds resolution;
+        boost::circular_buffer<Bucket> buckets;
+        // The period of the newest bucket, in resolutions since the epoch.
+        int64_t newest = 0;
+
+        int64_t oldest() const { return newest - int64_t(buckets.size()) + 1; }
+        int64_t PeriodOf(time_point time) const;
+        void Add(int64_t period, double value);
+        Point PointAt(int64_t period) const;
+    };
+
+    mutable std::mutex guard_;
+    std::vector<Ring> tiers_;
+};
+
+}  // httpi
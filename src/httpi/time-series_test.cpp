@@ -0,0 +1,103 @@
+#include "time-series.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+using std::chrono::hours;
+using std::chrono::minutes;
+using std::chrono::seconds;
+
+typedef httpi::TimeSeries::time_point time_point;
+
+int main() {
+    const time_point start(hours(24 * 365 * 50));
+
+    {
+        // Samples of the same second share its bucket.
+        httpi::TimeSeries ts;
+        assert(ts.tiers() == 3);
+        assert(ts.resolution(0) == seconds(1));
+        assert(ts.resolution(2) == hours(1));
+        assert(ts.Last(0, 10).empty());
+
+        ts.Add(start, 1);
+        ts.Add(start + std::chrono::milliseconds(500), 3);
+        ts.Add(start + seconds(2), 10);
+        auto points = ts.Last(0, 10);
+        assert(points.size() == 2);
+        assert(points[0].time == start);
+        assert(points[0].min == 1 && points[0].max == 3);
+        assert(points[0].mean == 2 && points[0].count == 2);
+        assert(points[1].time == start + seconds(2));
+        assert(points[1].mean == 10);
+
+        // All in the same minute and hour.
+        points = ts.Last(1, 10);
+        assert(points.size() == 1 && points[0].count == 3);
+        assert(points[0].min == 1 && points[0].max == 10);
+        assert(ts.Last(2, 10).size() == 1);
+
+        assert(ts.Last(0, 1).size() == 1);
+        assert(ts.Last(0, 1)[0].mean == 10);
+    }
+
+    {
+        // A sample per second for two days: the seconds tier keeps the last
+        // hour, the minutes one the last day, the hours one everything.
+        httpi::TimeSeries ts;
+        const int total = 2 * 24 * 3600;
+        for (int i = 0; i < total; ++i) {
+            ts.Add(start + seconds(i), i);
+        }
+        time_point end = start + seconds(total - 1);
+
+        auto points = ts.Query(0, start, end);
+        assert(points.size() == 3600);
+        assert(points.front().time == end - seconds(3599));
+        assert(points.back().mean == total - 1);
+
+        points = ts.Query(1, start, end);
+        assert(points.size() == 24 * 60);
+        assert(points.back().count == 60);
+        assert(points.back().min == total - 60);
+        assert(points.back().mean == total - 30.5);
+
+        points = ts.Query(2, start, end);
+        assert(points.size() == 48);
+        assert(points.front().time == start);
+        assert(points.front().mean == 1799.5);
+
+        // The finest tier reaching back far enough.
+        assert(ts.Query(end - minutes(10), end).size() == 601);
+        assert(ts.Query(end - hours(3), end).size() == 181);
+        assert(ts.Query(start, end).size() == 48);
+
+        // Older samples are only kept where they still fit.
+        ts.Add(start, -1);
+        assert(ts.Query(2, start, start)[0].min == -1);
+        assert(ts.Query(0, start, start).empty());
+    }
+
+    {
+        // Gaps leave empty buckets, skipped by queries, and a gap longer
+        // than a tier empties it.
+        httpi::TimeSeries ts({{seconds(1), 10}, {seconds(10), 10}});
+        ts.Add(start, 1);
+        ts.Add(start + seconds(5), 2);
+        auto points = ts.Query(0, start, start + seconds(5));
+        assert(points.size() == 2);
+        assert(points[1].time == start + seconds(5));
+
+        ts.Add(start + seconds(60), 3);
+        points = ts.Query(0, start, start + seconds(60));
+        assert(points.size() == 1 && points[0].mean == 3);
+        points = ts.Query(1, start, start + seconds(60));
+        assert(points.size() == 2);
+        assert(points[0].count == 2 && points[0].mean == 1.5);
+        assert(ts.Last(0, 5).size() == 1);
+    }
+
+    std::cout << "OK\n";
+    return 0;
+}
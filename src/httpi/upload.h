@@ -0,0 +1,151 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "displayer.h"
+
+namespace httpi {
+
+// Carries an upload from the server thread receiving it to the job consuming
+// it, a bounded number of bytes at a time. When the job falls behind, Ready
+// says so, the server stops reading from the client without holding its
+// thread, and TCP slows the client down: an upload of any size goes through
+// in about `capacity` bytes of memory.
+class UploadPipe {
+   public:
+    explicit UploadPipe(size_t capacity = 1 << 20) : capacity_(capacity) {}
+
+    // Whether `size` more bytes fit. If not, `wake` is called once they do,
+    // or once the reader gives up, from the reader's thread.
+    bool Ready(size_t size, std::function<void()> wake) {
+        std::lock_guard<std::mutex> lk(guard_);
+        if (Fits(size)) {
+            return true;
+        }
+        wake_ = std::move(wake);
+        wake_size_ = size;
+        return false;
+    }
+
+    // Never blocks: writers ask Ready() first, and a piece may go past the
+    // capacity. Returns false if the reader gave up.
+    bool Write(const char* data, size_t size) {
+        std::lock_guard<std::mutex> lk(guard_);
+        if (cancelled_) {
+            return false;
+        }
+        chunks_.emplace_back(data, size);
+        buffered_ += size;
+        filled_.notify_one();
+        return true;
+    }
+
+    // The whole body was written.
+    void Close() { End(false); }
+    // The body will not be complete.
+    void Abort() { End(true); }
+
+    // Waits for the next piece of the body. Returns false once the pipe was
+    // cancelled, or once everything was read: then aborted() tells whether
+    // the body was complete.
+    bool Read(std::string* chunk) {
+        std::function<void()> wake;
+        {
+            std::unique_lock<std::mutex> lk(guard_);
+            filled_.wait(lk, [&]() {
+                return closed_ || cancelled_ || !chunks_.empty();
+            });
+            if (chunks_.empty()) {
+                return false;
+            }
+            *chunk = std::move(chunks_.front());
+            chunks_.pop_front();
+            buffered_ -= chunk->size();
+            if (wake_ && Fits(wake_size_)) {
+                wake.swap(wake_);
+            }
+        }
+        if (wake) {
+            wake();
+        }
+        return true;
+    }
+
+    bool aborted() const {
+        std::lock_guard<std::mutex> lk(guard_);
+        return aborted_;
+    }
+
+    // For the reader to stop early: further writes fail, and a Read waiting
+    // in another thread returns false.
+    void Cancel() {
+        std::function<void()> wake;
+        {
+            std::lock_guard<std::mutex> lk(guard_);
+            cancelled_ = true;
+            chunks_.clear();
+            buffered_ = 0;
+            wake.swap(wake_);
+            filled_.notify_all();
+        }
+        if (wake) {
+            wake();
+        }
+    }
+
+   private:
+    bool Fits(size_t size) const {
+        return cancelled_ || buffered_ == 0 || buffered_ + size <= capacity_;
+    }
+
+    void End(bool aborted) {
+        std::lock_guard<std::mutex> lk(guard_);
+        closed_ = true;
+        aborted_ = aborted;
+        filled_.notify_all();
+    }
+
+    const size_t capacity_;
+    mutable std::mutex guard_;
+    std::condition_variable filled_;
+    std::deque<std::string> chunks_;
+    size_t buffered_ = 0;
+    // Set while the writer waits for room.
+    std::function<void()> wake_;
+    size_t wake_size_ = 0;
+    bool closed_ = false;
+    bool aborted_ = false;
+    bool cancelled_ = false;
+};
+
+// A sink writing the file sent as form field `field` to `pipe`, skipping the
+// other fields, and answering with `finish` once the body is complete. With
+// an empty `field`, takes a raw (non form) body.
+inline UploadSink PipeSink(std::shared_ptr<UploadPipe> pipe,
+                           std::string field,
+                           std::function<Response()> finish) {
+    UploadSink sink;
+    sink.write = [pipe, field](const char* name,
+                               const char*,
+                               const char* data,
+                               size_t size) {
+        return field != name || pipe->Write(data, size);
+    };
+    sink.ready = [pipe](size_t size, std::function<void()> wake) {
+        return pipe->Ready(size, std::move(wake));
+    };
+    sink.finish = [pipe, finish]() {
+        pipe->Close();
+        return finish();
+    };
+    sink.abort = [pipe]() { pipe->Abort(); };
+    return sink;
+}
+
+}  // httpi
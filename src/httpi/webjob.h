@@ -1,26 +1,448 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 
+#include "cancel.h"
+#include "events.h"
 #include "html/html.h"
 #include "job.h"
+#include "journal.h"
+#include "response.h"
+#include "snapshot.h"
 
 class WebJob {
-    std::shared_ptr<std::string> res_;
+   public:
+    // Where a job is at, as published by the job.
+    struct Progress {
+        uint64_t current;
+        // 0 if unknown.
+        uint64_t total;
+        std::string status;
+    };
+
+   private:
+    // What changes seldom, replaced as a whole on each change.
+    struct State {
+        // Bumped with each change.
+        uint64_t generation = 0;
+        uint64_t total = 0;
+        std::string status;
+        std::shared_ptr<const std::string> set_page;
+    };
+
+    // A page as rendered for one version of the job's state.
+    struct Page {
+        std::string html;
+        uint64_t generation;
+        uint64_t current;
+
+        bool NewerThan(const Page& p) const {
+            return generation != p.generation ? generation > p.generation
+                                              : current > p.current;
+        }
+    };
+
+    // Updated on every step of the job: a plain store.
+    std::atomic<uint64_t> current_{0};
+    // Progress events are sent when the progress gets there, about once per
+    // percent: the steps in between only pay for a comparison.
+    std::atomic<uint64_t> next_event_{0};
+    httpi::EventChannel events_;
+    // Tells apart the pages of different jobs at the same version.
+    const uint64_t instance_ = NextInstance();
+    const std::shared_ptr<httpi::CancelToken> cancel_ =
+        std::make_shared<httpi::CancelToken>();
+    // Where the job is checkpointed, if anywhere; set before it starts.
+    httpi::Journal* journal_ = nullptr;
+    uint64_t journal_key_ = 0;
+    // Neither the job publishing its state nor the requests rendering its
+    // page ever wait on each other: they swap immutable snapshots.
+    httpi::AtomicSnapshot<State> state_{std::make_shared<const State>()};
+    // The most recent page rendered, reused until the state changes.
+    mutable httpi::AtomicSnapshot<Page> page_{nullptr};
+
+    static uint64_t NextInstance() {
+        static std::atomic<uint64_t> next{0};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <class F>
+    void UpdateState(F&& f) {
+        state_.Update([&f](const std::shared_ptr<const State>& s) {
+            auto next = std::make_shared<State>(*s);
+            f(next.get());
+            ++next->generation;
+            return std::shared_ptr<const State>(std::move(next));
+        });
+    }
+
+    void ProgressEvent(uint64_t current) {
+        uint64_t total = state_.Load()->total;
+        next_event_.store(
+            current + std::max<uint64_t>(1, total ? total / 100 : current / 8),
+            std::memory_order_relaxed);
+        events_.Publish("progress", ProgressJson());
+    }
+
+    std::shared_ptr<const Page> CurrentPage() const {
+        std::shared_ptr<const State> s = state_.Load();
+        uint64_t current = current_.load(std::memory_order_acquire);
+
+        std::shared_ptr<const Page> cached = page_.Load();
+        if (cached && cached->generation == s->generation &&
+            cached->current == current) {
+            return cached;
+        }
+
+        // Requests seeing the same change at once may each render it: the
+        // page is kept unless a newer one was cached meanwhile.
+        auto page = std::make_shared<const Page>(
+            Page{s->set_page ? *s->set_page
+                             : RenderPage(Progress{current, s->total, s->status})
+                                   .Get(),
+                 s->generation,
+                 current});
+        page_.Update([&page](const std::shared_ptr<const Page>& old) {
+            return old && old->NewerThan(*page) ? old : page;
+        });
+        return page;
+    }
 
    public:
-    WebJob() : res_(std::make_shared<std::string>("empty")) {}
-    std::shared_ptr<std::string> page() { return res_; }
+    WebJob() {
+        cancel_->OnCancel([this]() { OnCancel(); });
+    }
+
+    Progress progress() const {
+        std::shared_ptr<const State> s = state_.Load();
+        return Progress{
+            current_.load(std::memory_order_acquire), s->total, s->status};
+    }
+
+    // {"current": ..., "total": ..., "status": "..."}, as sent in events.
+    std::string ProgressJson() const {
+        Progress p = progress();
+        std::string json = "{\"current\": " + std::to_string(p.current) +
+                           ", \"total\": " + std::to_string(p.total) +
+                           ", \"status\": \"";
+        for (char c : p.status) {
+            if (c == '"' || c == '\\') {
+                json += '\\';
+            }
+            json += c < ' ' ? ' ' : c;
+        }
+        return json + "\"}";
+    }
+
+    // Server-Sent Events following the job: "state" when its status or
+    // total change, "progress" as it progresses, and "finished" at the end,
+    // each with the ProgressJson().
+    httpi::EventChannel& events() { return events_; }
+
+    // Called once the job returned, see StartWebJob, with the error it threw
+    // if it did, which becomes its status. Sends the last event and ends the
+    // subscriptions. A job shut down saves a last checkpoint, to resume from
+    // on restart; any other, failed ones included, leaves the journal.
+    void Finished(const std::string& error = std::string()) {
+        if (!error.empty()) {
+            SetStatus("Failed: " + error);
+        }
+        if (journal_) {
+            if (error.empty() &&
+                cancel_->reason() == httpi::CancelToken::Reason::kShutdown) {
+                Checkpoint();
+            } else {
+                journal_->End(journal_key_);
+            }
+        }
+        events_.Publish("finished", ProgressJson());
+        events_.Close();
+    }
+
+    // Checkpointing, for jobs which can resume after the process restarts:
+    // kind() names the factory creating them anew, see RestoreWebJobs, and
+    // SaveState() serializes what RestoreState() needs to resume. Jobs with
+    // an empty kind() are not checkpointed.
+    virtual std::string kind() const { return std::string(); }
+    virtual std::string SaveState() const { return std::string(); }
+    virtual bool RestoreState(const std::string&) { return false; }
+
+    // Checkpoints the job to `journal` under `key` from now on, starting with
+    // its state now. Before the job starts, see StartWebJob.
+    void AttachJournal(httpi::Journal* journal, uint64_t key) {
+        journal_ = journal;
+        journal_key_ = key;
+        Checkpoint();
+    }
+
+    // Restores the progress saved in a checkpoint, then the job's own state.
+    bool Resume(const std::string& checkpoint) {
+        unsigned long long current, total;
+        size_t status_size;
+        int header = 0;
+        if (std::sscanf(checkpoint.c_str(),
+                        "%llu %llu %zu%n",
+                        &current,
+                        &total,
+                        &status_size,
+                        &header) != 3 ||
+            checkpoint[header++] != '\n' ||
+            checkpoint.size() - header < status_size) {
+            return false;
+        }
+        std::string status = checkpoint.substr(header, status_size);
+        current_.store(current, std::memory_order_release);
+        UpdateState([total, &status](State* s) {
+            s->total = total;
+            s->status = std::move(status);
+        });
+        return RestoreState(checkpoint.substr(header + status_size));
+    }
+
+    // A script keeping a page rendered by the job up to date with its events
+    // at `events_url`. Defaults to moving the progress bar and updating the
+    // status.
+    virtual std::string LiveScript(const std::string& events_url) const {
+        return "<script>(function() {"
+               "var es = new EventSource('" + events_url + "');"
+               "function show(e) {"
+               "var p = JSON.parse(e.data);"
+               "var bar = document.querySelector('.progress-bar');"
+               "if (bar && p.total) {"
+               "bar.style.width ="
+               " Math.min(100, 100 * p.current / p.total) + '%';"
+               "bar.textContent = p.current + ' / ' + p.total;"
+               "}"
+               "var cur = document.querySelector('.job-current');"
+               "if (cur) { cur.textContent = p.current; }"
+               "var st = document.querySelector('.job-status');"
+               "if (st) { st.textContent = p.status; }"
+               "}"
+               "es.addEventListener('progress', show);"
+               "es.addEventListener('state', show);"
+               "es.addEventListener('finished', function(e) {"
+               "show(e); es.close(); });"
+               "})();</script>";
+    }
+
+    // The page, rendered now if the job's state changed since the last time
+    // it was. Can be sent as is in an httpi::Response, without copying it.
+    std::shared_ptr<const std::string> page() const {
+        std::shared_ptr<const Page> p = CurrentPage();
+        return std::shared_ptr<const std::string>(p, &p->html);
+    }
+
+    // An ETag for a version of the page of the job `instance`, also telling
+    // apart versions published by a previous run of the process.
+    static std::string ETag(uint64_t instance,
+                            uint64_t generation,
+                            uint64_t current) {
+        static const std::string epoch = std::to_string(
+            std::chrono::system_clock::now().time_since_epoch().count());
+        return "\"" + epoch + "-" + std::to_string(instance) + "-" +
+               std::to_string(generation) + "-" + std::to_string(current) +
+               "\"";
+    }
+
+    // The page as served to clients. Defaults to page(), tagged with its
+    // version so that clients which already have it get a 304; jobs with
+    // large or unbounded output override it to stream.
+    virtual httpi::Response Render() {
+        std::shared_ptr<const Page> p = CurrentPage();
+        return httpi::Response(std::shared_ptr<const std::string>(p, &p->html))
+            .ETag(ETag(instance_, p->generation, p->current));
+    }
+
+    // The memory held by the job's results, for retention policies. Defaults
+    // to the size of the last page rendered.
+    virtual size_t result_bytes() const {
+        std::shared_ptr<const Page> p = page_.Load();
+        return p ? p->html.size() : 0;
+    }
+
+    // What the job leaves in the archive once evicted from its pool.
+    virtual std::string Summary() const { return name(); }
+
+    // Asks the job to stop, as cancelling it through its pool does.
+    void Stop() { cancel_->Cancel(); }
+    // To give to the pool running the job, see StartWebJob.
+    const std::shared_ptr<httpi::CancelToken>& cancel_token() const {
+        return cancel_;
+    }
+
     virtual void Do() = 0;
-    virtual void Stop() = 0;
-    ~WebJob() = default;
+    virtual ~WebJob() = default;
     virtual std::string name() const = 0;
 
    protected:
+    // Saves the progress and SaveState() to the journal, if the job has one.
+    // Called by the job at the points it can resume from, one at a time:
+    // from Do(), SaveState() needs no locking; jobs working on several
+    // threads call it where they serialize their results.
+    void Checkpoint() {
+        if (!journal_) {
+            return;
+        }
+        Progress p = progress();
+        journal_->Checkpoint(journal_key_,
+                             kind(),
+                             std::to_string(p.current) + " " +
+                                 std::to_string(p.total) + " " +
+                                 std::to_string(p.status.size()) + "\n" +
+                                 p.status + SaveState());
+    }
+
+    // Polled by Do() between steps; a single load.
+    bool cancelled() const { return cancel_->cancelled(); }
+
+    // Called once the job is cancelled, from the cancelling thread, for
+    // jobs blocked where polling cancelled() does not reach.
+    virtual void OnCancel() {}
+
+    // Cheap enough to call on every step of a loop. Expected not to go
+    // backwards: the cache keeps the page with the most progress.
+    void SetProgress(uint64_t current) {
+        current_.store(current, std::memory_order_release);
+        if (current >= next_event_.load(std::memory_order_relaxed)) {
+            ProgressEvent(current);
+        }
+    }
+
+    // Adds `n` to the progress, for jobs progressing on several threads at
+    // once. An atomic add on a shared counter: callers add steps by batches.
+    void AddProgress(uint64_t n) {
+        uint64_t current =
+            current_.fetch_add(n, std::memory_order_acq_rel) + n;
+        if (current >= next_event_.load(std::memory_order_relaxed)) {
+            ProgressEvent(current);
+        }
+    }
+
+    void SetTotal(uint64_t total) {
+        UpdateState([total](State* s) { s->total = total; });
+        next_event_.store(0, std::memory_order_relaxed);
+        events_.Publish("state", ProgressJson());
+    }
+
+    void SetStatus(std::string status) {
+        UpdateState([&status](State* s) { s->status = std::move(status); });
+        events_.Publish("state", ProgressJson());
+    }
+
+    // For pages showing more than the progress and the status: renders the
+    // page again when next asked for, and sends a "state" event.
+    void Refresh() {
+        UpdateState([](State*) {});
+        events_.Publish("state", ProgressJson());
+    }
+
+    // Replaces the rendered page with `html` from now on, for jobs whose
+    // page is not a view of their progress. Sends no event: such jobs
+    // publish their own.
     void SetPage(const httpi::html::Html& html) {
-        res_ = std::make_shared<std::string>(html.Get());
+        auto page = std::make_shared<const std::string>(html.Get());
+        UpdateState([&page](State* s) { s->set_page = std::move(page); });
+    }
+
+    // Renders the page for a given progress, only when it is asked for and
+    // at most once per version of the progress. Called from the thread of
+    // the request, concurrently with the job. Defaults to the status and a
+    // progress bar.
+    virtual httpi::html::Html RenderPage(const Progress& p) const {
+        using namespace httpi::html;
+        Html html;
+        html << P().AddClass("job-status") << p.status << Close();
+        if (p.total == 0) {
+            return html << P().AddClass("job-current")
+                        << std::to_string(p.current) << Close();
+        }
+        std::string percent = std::to_string(
+            std::min<uint64_t>(100, p.current * 100 / p.total));
+        // clang-format off
+        return html <<
+            Div().AddClass("progress") <<
+                Div().AddClass("progress-bar")
+                     .Attr("style", "width: " + percent + "%") <<
+                    std::to_string(p.current) + " / " +
+                        std::to_string(p.total) <<
+                Close() <<
+            Close();
+        // clang-format on
     }
 };
 
 typedef JobPool<WebJob> WebJobsPool;
+
+// A retention policy for web jobs, sized and summarized by the jobs
+// themselves. 0 for no limit.
+inline WebJobsPool::Retention WebJobRetention(size_t max_finished,
+                                              std::chrono::seconds max_age,
+                                              size_t max_result_bytes) {
+    WebJobsPool::Retention r;
+    r.max_finished = max_finished;
+    r.max_age = max_age;
+    r.max_result_bytes = max_result_bytes;
+    r.result_bytes = [](WebJob& job) { return job.result_bytes(); };
+    r.summarize = [](WebJob& job) { return job.Summary(); };
+    return r;
+}
+
+// Starts `job` in `jp`, ending its events once it returns, and cancelling it
+// after `timeout` unless 0. Jobs which have a kind() are checkpointed to
+// `journal`, if given, until they return.
+inline size_t StartWebJob(WebJobsPool& jp,
+                          std::unique_ptr<WebJob> job,
+                          httpi::Priority priority = httpi::Priority::kNormal,
+                          std::chrono::steady_clock::duration timeout =
+                              std::chrono::steady_clock::duration::zero(),
+                          httpi::Journal* journal = nullptr) {
+    if (journal && !job->kind().empty()) {
+        job->AttachJournal(journal, journal->NewKey());
+    }
+    auto cancel = job->cancel_token();
+    return jp.StartJob(std::move(job),
+                       priority,
+                       timeout,
+                       cancel,
+                       [](Job<WebJob>& j) { j.job_data().Finished(j.error()); });
+}
+
+// Creates a job of some kind(), to Resume() from a checkpoint.
+typedef std::map<std::string, std::function<std::unique_ptr<WebJob>()>>
+    WebJobFactories;
+
+// Starts again the jobs left in `journal` by a previous run of the process,
+// from their last checkpoint, as StartWebJob would. Returns how many. Those
+// of an unknown kind, or which fail to resume, leave the journal.
+inline size_t RestoreWebJobs(
+    WebJobsPool& jp,
+    httpi::Journal* journal,
+    const WebJobFactories& factories,
+    httpi::Priority priority = httpi::Priority::kNormal,
+    std::chrono::steady_clock::duration timeout =
+        std::chrono::steady_clock::duration::zero()) {
+    size_t restored = 0;
+    for (auto& entry : journal->Live()) {
+        auto factory = factories.find(entry.kind);
+        std::unique_ptr<WebJob> job;
+        if (factory != factories.end()) {
+            job = factory->second();
+        }
+        if (!job || !job->Resume(entry.data)) {
+            journal->End(entry.key);
+            continue;
+        }
+        job->AttachJournal(journal, entry.key);
+        StartWebJob(jp, std::move(job), priority, timeout);
+        ++restored;
+    }
+    return restored;
+}